@@ -82,14 +82,14 @@ def initialize_hypers():
     return [0, 16, 3, 1, 5, 0.5]
 
 
-def update_hypers(state, hypers, rng):
+def update_hypers(states, hypers, rng):
     """ Update hypers if a prior is assumed on the hyperparameters,
     otherwise if fixed values are assumed, return hypers
 
     Parameters
     ----------
-    state : :obj:`list` of :obj:`float`
-        model parameters
+    states : :obj:`numpy.ndarray` of shape (n_clusters, state_dim)
+        states of the clusters, one per row
     hypers : :obj:`list` of :obj:`float`
         model hyperparameters
     rng : numpy.random._generator.Generator'
@@ -129,7 +129,7 @@ def draw(state, hypers, rng):
     return [mu_, lam_]
 
 
-def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
+def update_summary_statistics(x, add, sum_stats, state):
     """ Updates cluster statistics when a datum is added or removed from it,
     the statistics appears in the sampling of the full conditionals of the model for non-conjugate hierarchies and
     in the computation of the posterior hyperparameters for conjugate hierarchies.
@@ -145,25 +145,20 @@ def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
         list of summary statistics used
     state : :obj:`list` of :obj:`float`
         model parameters
-    cluster_data_values : :obj:`list` of :obj:`float`
-        data in the current cluster
 
     Returns
     -------
-    :obj:`list` of :obj:`list` of :obj:`float`
-        updated summary statistics and cluster data values
+    :obj:`list` of :obj:`float`
+        updated summary statistics
     """
     mu = state[0]
     if not len(sum_stats):
         sum_stats = [0, 0]  # initialize sum_stats to zeros
     if add:
         sum_stats[0] += abs(mu - x[0])
-        cluster_data_values = np.append(cluster_data_values, x)
     else:
         sum_stats[0] -= abs(mu - x[0])
-        ind = np.where(cluster_data_values == x)
-        cluster_data_values = np.delete(cluster_data_values, ind[0][0], ind[1][0])
-    return [sum_stats, cluster_data_values]
+    return sum_stats
 
 
 def sample_full_cond(state, sum_stats, rng, cluster_data_values, hypers):
@@ -177,8 +172,8 @@ def sample_full_cond(state, sum_stats, rng, cluster_data_values, hypers):
         list of summary statistics used
     rng : numpy.random._generator.Generator
         random number generator to be used when sampling
-    cluster_data_values : :obj:`list` of :obj:`float`
-        data in the current cluster
+    cluster_data_values : :obj:`numpy.ndarray` of shape (card, 1)
+        read-only view of the data in the current cluster
     hypers : :obj:`list` of :obj:`float`
         model hyperparameters
 
@@ -199,8 +194,8 @@ def sample_full_cond(state, sum_stats, rng, cluster_data_values, hypers):
     log_a_rate = log_target_prop - log_target_curr
     log_alpha = np.log(ss.uniform.rvs(loc=0, scale=1, size=1, random_state=rng))
     if log_alpha < log_a_rate:
-        state[0] = prop_unc_params[0]
-        state[1] = np.exp(prop_unc_params[1])
+        state[0] = prop_unc_params[0][0]
+        state[1] = np.exp(prop_unc_params[1][0])
         sum_stats[0] = sum_stats[1]  # sum_abs_diff_curr = sum_abs_diff_prop
 
     return [state, sum_stats]
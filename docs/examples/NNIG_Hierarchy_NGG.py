@@ -9,7 +9,8 @@ f(x_i|mu,sig) = N(mu,sig^2)
 This hierarchy is conjugate, therefore the following methods have to be
 implemented: is_conjugate, like_lpdf, marg_lpdf, initialize_state,
 initialize_hypers, update_hypers, draw, compute_posterior_hypers,
-update_summary_statistics.
+update_summary_statistics. Since the summary statistics are additive, the
+latter is replaced here by suff_stat.
 The state is composed of mean and variance. The state hyperparameters,
 contained in the Hypers object, are (mu0, lambda0, alpha0, beta0), all
 scalar values. In the following implementation we assume a prior on the
@@ -76,6 +77,42 @@ def marg_lpdf(x, hypers):
     return ss.t.logpdf(x, 2 * alpha0, mu0, sig_n)
 
 
+def like_lpdf_batch(X, state):
+    """ Likelihood log-density evaluated on a whole grid at once (optional)
+
+    Parameters
+    ----------
+    X : :obj:`numpy.ndarray` of shape (n_points, 1)
+        points in which lpdf is evaluated, read-only
+    state : :obj:`list` of :obj:`float`
+        model parameters
+
+    Returns
+    -------
+    :obj:`numpy.ndarray` of shape (n_points, )
+        lpdf of each point
+    """
+    return ss.norm.logpdf(X[:, 0], state[0], np.sqrt(state[1]))
+
+
+def marg_lpdf_batch(X, hypers):
+    """ Marginal log density evaluated on a whole grid at once (optional)
+
+    Parameters
+    ----------
+    X : :obj:`numpy.ndarray` of shape (n_points, 1)
+        points in which lpdf is evaluated, read-only
+    hypers : :obj:`list` of :obj:`float`
+        model hyperparameters
+
+    Returns
+    -------
+    :obj:`numpy.ndarray` of shape (n_points, )
+        lpdf of each point
+    """
+    return marg_lpdf(X[:, 0], hypers)
+
+
 def initialize_state(hypers):
     """
 
@@ -180,43 +217,23 @@ def compute_posterior_hypers(card, hypers, sum_stats):
     return post_hypers
 
 
-def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
-    """ Updates cluster statistics when a datum is added or removed from it,
-    the statistics appears in the sampling of the full conditionals of the
-    model for non-conjugate hierarchies and in the computation of the posterior
-    hyperparameters for conjugate hierarchies. In this model, the summary statistics
-    are the current and proposed values of the sum of absolute differences.
+def suff_stat(X):
+    """ Additive sufficient statistics of the data, used in place of
+    update_summary_statistics: they are computed once for the whole dataset,
+    and the statistics of a cluster are the sum of those of its data. In this
+    model, they are the sum and the sum of squares of the data.
 
     Parameters
     ----------
-    x : :obj:`list` of :obj:`float`
-        datum (univariate)
-    add : bool
-        if True, the datum has to be added to the cluster, if False, it has to be removed from the cluster
-    sum_stats : :obj:`list` of :obj:`float`
-        list of summary statistics used
-    state : :obj:`list` of :obj:`float`
-        model parameters
-    cluster_data_values : :obj:`list` of :obj:`float`
-        data in the current cluster
+    X : :obj:`numpy.ndarray` of shape (n_data, 1)
+        data, one datum per row, read-only
 
     Returns
     -------
-    :obj:`list` of :obj:`list` of :obj:`float`
-        updated summary statistics and cluster data values
+    :obj:`numpy.ndarray` of shape (n_data, 2)
+        summary statistics of each datum
     """
-    if not len(sum_stats):
-        sum_stats = [0, 0]
-    data_sum = sum_stats[0]
-    data_sum_squares = sum_stats[1]
-    if add:
-        data_sum += x[0]
-        data_sum_squares += x[0] ** 2
-    else:
-        data_sum -= x[0]
-        data_sum_squares -= x[0] ** 2
-    sum_stats = [data_sum, data_sum_squares]
-    return [sum_stats, cluster_data_values]
+    return np.column_stack([X[:, 0], X[:, 0] ** 2])
 
 
 def update_hypers(states, hypers, rng):
@@ -228,8 +245,8 @@ def update_hypers(states, hypers, rng):
 
     Parameters
     ----------
-    states : :obj:`list` of :obj:`list` of :obj:`float`
-        states of the clusters
+    states : :obj:`numpy.ndarray` of shape (n_clusters, state_dim)
+        states of the clusters, one per row
     hypers : :obj:`list` of :obj:`float`
         model hyperparameters
     rng : numpy.random._generator.Generator
@@ -240,7 +257,6 @@ def update_hypers(states, hypers, rng):
     :obj:`list` of :obj:`float`
         updated hyperparameters
     """
-    states = np.array(states)
     num = np.sum(states[:, 0] / states[:, 1])
     b_n = np.sum(1.0 / states[:, 1])
     beta_n = np.sum(((hypers[0] - states[:, 0])**2)/states[:, 1])
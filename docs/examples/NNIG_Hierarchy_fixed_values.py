@@ -96,14 +96,14 @@ def initialize_hypers():
     return [1, 0.3, 1.5, 2]
 
 
-def update_hypers(state, hypers, rng):
+def update_hypers(states, hypers, rng):
     """Update hypers if a prior is assumed on the hyperparameters,
     otherwise if fixed values are assumed, return hypers
 
     Parameters
     ----------
-    state : :obj:`list` of :obj:`float`
-        model parameters
+    states : :obj:`numpy.ndarray` of shape (n_clusters, state_dim)
+        states of the clusters, one per row
     hypers : :obj:`list` of :obj:`float`
         model hyperparameters
     rng : numpy.random._generator.Generator
@@ -182,7 +182,7 @@ def compute_posterior_hypers(card, hypers, sum_stats):
     return post_hypers
 
 
-def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
+def update_summary_statistics(x, add, sum_stats, state):
     """ Updates cluster statistics when a datum is added or removed from it,
     the statistics appears in the sampling of the full conditionals of the
     model for non-conjugate hierarchies and in the computation of the posterior
@@ -199,13 +199,11 @@ def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
         list of summary statistics used
     state : :obj:`list` of :obj:`float`
         model parameters
-    cluster_data_values : :obj:`list` of :obj:`float`
-        data in the current cluster
 
     Returns
     -------
-    :obj:`list` of :obj:`list` of :obj:`float`
-        updated summary statistics and cluster data values
+    :obj:`list` of :obj:`float`
+        updated summary statistics
     """
     if not len(sum_stats):
         sum_stats = [0, 0]
@@ -218,4 +216,4 @@ def update_summary_statistics(x, add, sum_stats, state, cluster_data_values):
         data_sum -= x[0]
         data_sum_squares -= x[0] ** 2
     sum_stats = [data_sum, data_sum_squares]
-    return [sum_stats, cluster_data_values]
+    return sum_stats
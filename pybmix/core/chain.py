@@ -1,4 +1,5 @@
 import logging
+import mmap
 
 import numpy as np
 from google.protobuf.pyext._message import RepeatedScalarContainer
@@ -7,35 +8,140 @@ import pybmix.proto.matrix_pb2 as matrix_pb2
 from pybmix.utils.proto_utils import get_field
 
 
+class BufferChain(object):
+    """Read-only sequence of serialized states stored as length-delimited
+    records in one contiguous buffer, i.e. a varint with the size of the
+    serialized message followed by the message itself, with the offset of
+    every record. States are sliced out of the buffer only when accessed.
+
+    Parameters
+    ----------
+    data: object supporting the buffer protocol
+        the records, e.g. SerializedCollector.get_chain_buffer() or a memory
+        map of the file written by StreamingFileCollector
+    offsets: numpy array of uint64
+        the offset of every record in 'data'
+    """
+
+    def __init__(self, data, offsets):
+        self._data = memoryview(data).cast("B") if len(offsets) > 0 else b""
+        self._offsets = offsets
+
+    def __len__(self):
+        return len(self._offsets)
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += len(self)
+        if not 0 <= i < len(self):
+            raise IndexError("state index out of range")
+
+        # each record is a varint with the message size followed by the message
+        pos = int(self._offsets[i])
+        size, shift = 0, 0
+        while True:
+            byte = self._data[pos]
+            pos += 1
+            size |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return bytes(self._data[pos:pos + size])
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+
+class MmapChain(BufferChain):
+    """BufferChain over the states written by a StreamingFileCollector. The
+    file is memory-mapped, so opening a chain does not load it in memory.
+
+    Parameters
+    ----------
+    path: string
+        the file passed to StreamingFileCollector, its index is expected in
+        path + ".idx"
+    """
+
+    def __init__(self, path):
+        self.path = path
+        offsets = np.fromfile(path + ".idx", dtype="<u8")
+        data = b""
+        if len(offsets) > 0:
+            with open(path, "rb") as f:
+                data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        super(MmapChain, self).__init__(data, offsets)
+
+
 class MCMCchain(object):
     """This class represents an MCMC chain obtained by running the algorithm
-    for a MixtureModel. It saves the visited states during the MCMC iterations
-    and has a useful 'extract' method to get the chain of one (possibly
-    vector or matrix-valued) parameter in a numpy array.
+    for a MixtureModel. It gives access to the visited states during the MCMC
+    iterations and has a useful 'extract' method to get the chain of one
+    (possibly vector or matrix-valued) parameter in a numpy array.
+
+    Unless 'deserialize' is True, opening a chain does not decode it: states
+    are deserialized only when accessed, and both the decoded states and the
+    extracted parameters are cached. MixtureModel.get_chain() opens chains
+    this way.
 
     Parameters
     ----------
-    serialized_chain: list of bytes
+    serialized_chain: sequence of bytes, e.g. a list, a BufferChain or a
+        CompressedChain
         serialized protobuf messages representing the states of the MCMC
     objtype: 
+    deserialize: bool (default True)
+        if True, all the states are decoded upfront
+    collector: SerializedCollector, StreamingFileCollector or None
+        the collector holding the chain, if given fields are extracted
+        natively through its 'extract_field' method
+    cache: bool (default True)
+        if False, decoded states and extracted parameters are not kept
     """
 
-    def __init__(self, serialized_chain, objtype, deserialize=True):
+    def __init__(self, serialized_chain, objtype, deserialize=True,
+                 collector=None, cache=True):
         if len(serialized_chain) == 0:
             logging.error("Supplied empty 'serialized_chain', aborting")
             return
 
         self.objtype = objtype
         self.serialized_chain = serialized_chain
-        self.chain = None
+        self.collector = collector
+        self.cache = cache
+        self._states = {}
+        self._fields = {}
         if deserialize:
-            self.chain = np.array(
-                [self._deserialize(x) for x in serialized_chain])
+            self._states = {i: self._deserialize(x)
+                            for i, x in enumerate(serialized_chain)}
+
+    def __len__(self):
+        return len(self.serialized_chain)
+
+    @property
+    def chain(self):
+        """numpy array of all the decoded states. Accessing it decodes the
+        whole chain, prefer 'get_state' and 'extract'."""
+        return np.array([self.get_state(i) for i in range(len(self))])
+
+    def get_state(self, i):
+        """Returns the i-th state of the chain as a message of type
+        'objtype'"""
+        if i < 0:
+            i += len(self)
+        state = self._states.get(i)
+        if state is None:
+            state = self._deserialize(self.serialized_chain[i])
+            if self.cache:
+                self._states[i] = state
+        return state
 
     def extract(self, param_name, to_arviz=False):
         """Extracts the chain relative to 'param_name' in a numpy format
         If 'param_name' is in a nested field, use the dot syntax to
-        join fields.
+        join fields. The extracted array is cached and every call returns a
+        copy of it, which the caller is free to modify.
 
         Parameters
         ----------
@@ -52,68 +158,74 @@ class MCMCchain(object):
         >>> chain = mixture_model.get_chain()
         >>> card_chain = chain.extract("cluster_states[0].cardinality")
         """
-        chain = self.chain if self.chain is not None else self.serialized_chain
-        extractor = self._get_extractor(param_name)
-        out = None
+        out = self._fields.get(param_name)
+        if out is not None:
+            out = out.copy()
+        else:
+            out = self._extract(param_name)
+            if out is not None and self.cache:
+                self._fields[param_name] = out.copy()
+
+        if out is not None and to_arviz:
+            out = self.to_arviz(param_name, out)
+
+        return out
+
+    def _extract(self, param_name):
+        if self.collector is not None:
+            try:
+                return self.collector.extract_field(param_name)
+            except (ValueError, IndexError) as e:
+                logging.info("Native extraction of '{0}' failed ({1}), "
+                             "falling back to Python".format(param_name, e))
+
+        def extractor(i):
+            return get_field(self.get_state(i), param_name)
 
         # we need to perform these checks because we're checking also
         # for base classes
-        if isinstance(extractor(chain[0]), RepeatedScalarContainer):
-            out = self._extract_repeated(chain, extractor)
-        elif isinstance(extractor(chain[0]), matrix_pb2.Vector):
-            out = self._extract_vector(chain, extractor)
-        elif isinstance(extractor(chain[0]), matrix_pb2.Matrix):
-            out = self._extract_matrix(chain, extractor)
+        first = extractor(0)
+        if isinstance(first, RepeatedScalarContainer):
+            return self._extract_repeated(extractor)
+        elif isinstance(first, matrix_pb2.Vector):
+            return self._extract_vector(extractor)
+        elif isinstance(first, matrix_pb2.Matrix):
+            return self._extract_matrix(extractor)
         else:
             try:
-                out = np.array([extractor(x) for x in chain])
+                return np.array([extractor(i) for i in range(len(self))])
             except Exception as e:
                 logging.error(e)
 
-        if out is not None and to_arviz:
-            out = self.to_arviz(param_name, chain)
-
-        return out
-
-    def _extract_repeated(self, chain, extractor):
-        first = extractor(chain[0])
-        out = np.empty((len(chain), len(first)), dtype=type(first[0]))
+    def _extract_repeated(self, extractor):
+        first = extractor(0)
+        out = np.empty((len(self), len(first)), dtype=type(first[0]))
         out[0, :] = first
-        for i in range(1, len(chain)):
-            out[i, :] = extractor(chain[i])
+        for i in range(1, len(self)):
+            out[i, :] = extractor(i)
         return out
 
-    def _extract_vector(self, chain, extractor):
+    def _extract_vector(self, extractor):
         def to_numpy(msg):
             return np.array(msg.data)
 
-        first = extractor(chain[0])
-        out = np.empty((len(chain), first.size))
-        for i in range(len(chain)):
-            out[i, :] = to_numpy(extractor(chain[i]))
+        first = extractor(0)
+        out = np.empty((len(self), first.size))
+        for i in range(len(self)):
+            out[i, :] = to_numpy(extractor(i))
         return out
 
-    def _extract_matrix(self, chain, extractor):
+    def _extract_matrix(self, extractor):
         def to_numpy(msg):
             order = "T" if msg.rowmajor else "F"
             return np.array(msg.data).reshape(msg.rows, msg.cols, order=order)
 
-        first = extractor(chain[0])
-        out = np.empty((len(chain), first.rows, first.cols))
-        for i in range(len(chain)):
-            out[i, :, :] = to_numpy(extractor(chain[i]))
+        first = extractor(0)
+        out = np.empty((len(self), first.rows, first.cols))
+        for i in range(len(self)):
+            out[i, :, :] = to_numpy(extractor(i))
         return out
 
-    def _get_extractor(self, param_name):
-        if self.chain is None:
-            def extractor(x):
-                return get_field(self._deserialize(x), param_name)
-        else:
-            def extractor(x):
-                return get_field(x, param_name)
-
-        return extractor
-
     @staticmethod
     def to_arviz(name, chain):
         import arviz as az
@@ -127,3 +239,28 @@ class MCMCchain(object):
         out = self.objtype()
         out.ParseFromString(bytes)
         return out
+
+
+def stack_chains(chains, param_name, to_arviz=False):
+    """Extracts 'param_name' from several MCMCchain objects of equal length
+    and stacks them in a numpy array of shape (n_chains, n_iter, ...)
+
+    Parameters
+    ----------
+    chains: list of MCMCchain
+        e.g. the output of MixtureModel.get_chains()
+    param_name: string
+        the name of the parameter to extract, see MCMCchain.extract
+    to_arviz: bool (default False)
+        if True, converts the stacked chains to an instance of
+        arviz.data.inference_data.InferenceData
+    """
+    out = np.stack([chain.extract(param_name) for chain in chains])
+    if to_arviz:
+        import arviz as az
+
+        if out.ndim == 2:
+            out = out[:, :, np.newaxis]
+        out = az.convert_to_inference_data({param_name: out})
+
+    return out
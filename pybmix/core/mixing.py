@@ -2,12 +2,13 @@ import abc
 import logging
 
 import numpy as np
-from scipy.special import loggamma, gamma
+from scipy.special import loggamma
 
 import pybmix.proto.mixing_id_pb2 as mixing_id
 from pybmix.proto.distribution_pb2 import BetaDistribution, GammaDistribution
 from pybmix.proto.mixing_prior_pb2 import DPPrior, PYPrior, TruncSBPrior
-from pybmix.utils.combinatorials import stirling, generalized_factorial_memoizer
+from pybmix.utils.combinatorials import log_stirling, \
+    log_scaled_generalized_factorial
 
 
 class BaseMixing(metaclass=abc.ABCMeta):
@@ -66,11 +67,17 @@ class DirichletProcessMixing(BaseMixing):
         else:
             total_mass = self.total_mass_fixed
 
-        out = np.zeros_like(grid, dtype=np.float)
-        for i, g in enumerate(grid):
-            out[i] = gamma(total_mass) / gamma(total_mass + nsamples) * \
-                     stirling(nsamples, g) * (total_mass) ** g
-
+        # p(k) = Gamma(M) / Gamma(M + n) * |s(n, k)| * M^k
+        grid = np.asarray(grid, dtype=int)
+        if grid.size == 0:
+            return np.zeros(0)
+        log_s = log_stirling(nsamples, max(int(grid.max()), 0))
+        valid = (grid >= 0) & (grid < len(log_s))
+        k = grid[valid]
+        out = np.zeros(len(grid))
+        out[valid] = np.exp(
+            loggamma(total_mass) - loggamma(total_mass + nsamples) +
+            log_s[k] + k * np.log(total_mass))
         return out
 
     def _build_prior_proto(self, total_mass, total_mass_prior):
@@ -136,7 +143,6 @@ class PitmanYorMixing(BaseMixing):
     def __init__(self, strength, discount):
         self._check_args(strength, discount)
         self._build_prior_proto(strength, discount)
-        self.generalized_factorial = generalized_factorial_memoizer(discount)
 
     def prior_cluster_distribution(self, grid, nsamples):
         """
@@ -152,16 +158,20 @@ class PitmanYorMixing(BaseMixing):
         """
         strength = self.prior_proto.fixed_values.strength
         discount = self.prior_proto.fixed_values.discount
-        out = np.zeros_like(grid, dtype=np.float)
-
+        # p(k) = prod_{l < k} (strength + l * discount) /
+        #        (strength)_n * C(n, k; discount) / discount^k
+        grid = np.asarray(grid, dtype=int)
+        if grid.size == 0:
+            return np.zeros(0)
+        log_c = log_scaled_generalized_factorial(
+            nsamples, discount, max(int(grid.max()), 0))
+        valid = (grid >= 0) & (grid < len(log_c))
+        k = grid[valid]
+        vnk_num = np.concatenate([[0], np.cumsum(
+            np.log(strength + np.arange(len(log_c) - 1) * discount))])
         vnk_den = loggamma(strength + nsamples) - loggamma(strength)
-        for i, k in enumerate(grid):
-            vnk_num = np.sum(
-                [np.log(strength + l * discount) for l in range(k)])
-            vnk = vnk_num - vnk_den
-            out_logscale = vnk + np.log(self.generalized_factorial(nsamples, k)) - \
-                           k * np.log(discount)
-            out[i] = np.exp(out_logscale)
+        out = np.zeros(len(grid))
+        out[valid] = np.exp(vnk_num[k] - vnk_den + log_c[k])
         return out
 
     def _build_prior_proto(self, strength, discount):
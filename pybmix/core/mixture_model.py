@@ -1,5 +1,9 @@
 import os
 import sys
+from concurrent.futures import ProcessPoolExecutor
+from multiprocessing import shared_memory
+
+import numpy as np
 
 HERE = os.path.dirname(os.path.realpath(__file__))
 BUILD_DIR = os.path.join(HERE, "../../build/")
@@ -8,14 +12,88 @@ sys.path.insert(0, os.path.realpath(BUILD_DIR))
 import pybmix.core.mixing as mix
 import pybmix.proto.algorithm_id_pb2 as algorithm_id
 from pybmix.core.hierarchy import BaseHierarchy
-from pybmix.core.chain import MCMCchain
+from pybmix.core.chain import BufferChain, MCMCchain, MmapChain
 from pybmix.proto.algorithm_state_pb2 import AlgorithmState
-from pybmixcpp import AlgorithmWrapper, ostream_redirect
+from pybmixcpp import AlgorithmWrapper, Checkpoint, CompressedChain, \
+    effective_sample_size, ostream_redirect, split_rhat
 
 MARGINAL_ALGORITHMS = ["Neal2", "Neal3", "Neal8", "SplitMerge"]
 CONDITIONAL_ALGORITHMS = ["BlockedGibbs"]
 
 
+def _run_chain(args):
+    """Runs one independent chain in a worker process and returns the buffer
+    of its serialized states, their offsets (see BufferChain) and, if
+    diagnostics are enabled, the traces of the diagnostics as a dict. Each
+    process owns its own bayesmix random engine. The data are read from the
+    shared memory block 'y_name' instead of being pickled to every worker."""
+    algo_name, hier_name, mix_name, hier_prior, mix_prior, hier_impl, \
+        y_name, y_shape, niter, nburn, rng_seed, diagnostics = args
+    algo = AlgorithmWrapper(algo_name, hier_name, mix_name, hier_prior,
+                            mix_prior)
+    if hier_impl is not None:
+        algo.load_py_hier_implementation(hier_impl)
+    algo.set_diagnostics(diagnostics)
+    shm = shared_memory.SharedMemory(name=y_name)
+    try:
+        # The algorithm keeps its own copy of the data, the view is only
+        # read while the run starts
+        y = np.ndarray(y_shape, dtype=np.float64, buffer=shm.buf)
+        with ostream_redirect(stdout=True, stderr=True):
+            algo.run(y, niter, nburn, rng_seed)
+    finally:
+        y = None
+        shm.close()
+    collector = algo.get_collector()
+    traces = None
+    if diagnostics:
+        diag = algo.get_diagnostics()
+        traces = {name: diag.get_trace(name) for name in diag.get_names()}
+    return collector.get_chain_buffer().tobytes(), \
+        collector.get_chain_offsets().copy(), traces
+
+
+def _run_shard(args):
+    """Runs the sampler on one shard of the data in a worker process and
+    returns its last state, serialized. The chain itself is not stored."""
+    algo_name, hier_name, mix_name, hier_prior, mix_prior, hier_impl, y, \
+        niter, nburn, rng_seed = args
+    algo = AlgorithmWrapper(algo_name, hier_name, mix_name, hier_prior,
+                            mix_prior)
+    if hier_impl is not None:
+        algo.load_py_hier_implementation(hier_impl)
+    algo.set_store_chain(False)
+    with ostream_redirect(stdout=True, stderr=True):
+        algo.run(y, niter, nburn, rng_seed)
+    return Checkpoint.from_bytes(algo.checkpoint()).state
+
+
+def _merge_shard_states(shard_states, shards, n_data):
+    """Merges the last states of the shards into a state of the full data:
+    the clusters of all shards side by side, each datum allocated to the
+    cluster it had in its shard. Mixing state and hyperparameters are those
+    of the first shard."""
+    merged = AlgorithmState()
+    merged.CopyFrom(shard_states[0])
+    del merged.cluster_states[:]
+    del merged.cluster_allocs[:]
+
+    allocs = np.empty(n_data, dtype=np.int64)
+    for state, shard in zip(shard_states, shards):
+        allocs[shard] = np.asarray(state.cluster_allocs) + \
+            len(merged.cluster_states)
+        merged.cluster_states.extend(state.cluster_states)
+    merged.cluster_allocs.extend(allocs.tolist())
+    return merged
+
+
+def load_compressed_chain(path):
+    """Returns the MCMCchain saved by MixtureModel.save_compressed_chain.
+    States are decoded only when accessed."""
+    chain = CompressedChain.load(path)
+    return MCMCchain(chain, AlgorithmState, False, chain)
+
+
 class MixtureModel(object):
     def __init__(self, mixing, hierarchy):
         if not isinstance(mixing, mix.BaseMixing):
@@ -27,13 +105,104 @@ class MixtureModel(object):
 
         self.mixing = mixing
         self.hierarchy = hierarchy
+        self.out_file = None
+        self._handle = None
+        self._chain_traces = None
 
-    def run_mcmc(self, y, algorithm="Neal2", niter=1000, nburn=500, rng_seed=-1):
-        if algorithm not in (MARGINAL_ALGORITHMS + CONDITIONAL_ALGORITHMS):
+    def run_mcmc(self, y, algorithm="Neal2", niter=1000, nburn=500, rng_seed=-1,
+                 out_file=None, record_allocations=False, density_grid=None,
+                 density_probs=(), store_chain=True, thin=1, fields=None,
+                 profile=False, trace_file=None, compress_chain=False,
+                 diagnostics=False):
+        """Runs the MCMC algorithm on the data 'y'.
+        If 'out_file' is given, the chain is streamed to that file (and its
+        index to out_file + '.idx') while sampling instead of being kept in
+        memory; get_chain() then reads it back lazily through a memory map.
+        If 'record_allocations' is True, the cluster allocations of every
+        saved iteration are also written to a dense (niter - nburn, n) int32
+        matrix while sampling, see get_allocations().
+        If 'density_grid' is given, the pointwise mean density on the grid and
+        its quantiles of probabilities 'density_probs' are updated after every
+        saved iteration, see DensityEstimator.online_density_summary(). With
+        'store_chain' False the chain itself is not stored.
+        Only one every 'thin' iterations after the burn-in is kept; the
+        sampler still builds the state of every iteration, thinning saves only
+        storing it. If 'fields' is a list of (possibly nested) field names of
+        AlgorithmState, e.g. ["cluster_allocs", "mixing_state"], only those
+        fields are stored.
+        Densities can not be evaluated from chains stored with 'fields'.
+        If 'profile' is True, the phases of the run are timed and the calls to
+        Python hierarchies counted, see get_profile(). If 'trace_file' is
+        given, the timed calls are also written there as Chrome trace events
+        (chrome://tracing, Perfetto), which implies 'profile'.
+        If 'compress_chain' is True, the chain is kept in memory in a compact
+        format, which stores the allocations as differences between
+        consecutive iterations, see save_compressed_chain(). A positive int
+        sets the interval between full copies of the allocations (default
+        64), the longest run of differences decoded to read a single state.
+        If 'diagnostics' is True, convergence diagnostics of scalar summaries
+        of the saved iterations are updated while sampling, see
+        get_diagnostics().
+        """
+        self._setup_run(algorithm, out_file, record_allocations, density_grid,
+                        density_probs, store_chain, profile, trace_file,
+                        compress_chain, diagnostics)
+        with ostream_redirect(stdout=True, stderr=True):
+            self._algo.run(y, niter, nburn, rng_seed, thin, fields or [])
+
+    def run_mcmc_async(self, y, algorithm="Neal2", niter=1000, nburn=500,
+                       rng_seed=-1, ess_target=None, ess_on="n_clusters",
+                       check_every=100, out_file=None,
+                       record_allocations=False, density_grid=None,
+                       density_probs=(), store_chain=True, thin=1,
+                       fields=None, profile=False, trace_file=None,
+                       compress_chain=False, diagnostics=False):
+        """Starts the MCMC algorithm on the data 'y' in a background thread
+        and returns at once a RunHandle, with methods
+
+            progress(): dict with the number of iterations run 'iteration',
+                'n_iter', 'fraction', 'elapsed' seconds,
+                'iterations_per_second', 'status' and, with 'ess_target',
+                the last effective sample size 'ess'
+            wait(timeout=-1): waits for the end of the run, at most
+                'timeout' seconds if not negative, returns whether it ended
+            join(): waits for the end of the run, raises its error if any
+                and returns its final status
+            cancel(): stops the run after the current iteration
+            is_done(), status: 'running', 'finished', 'converged',
+                'cancelled' or 'failed'
+
+        If 'ess_target' is given, the run stops as soon as the effective
+        sample size of 'ess_on' ('n_clusters' or 'log_likelihood') over the
+        iterations after the burn-in reaches it, estimated from batch means
+        and checked every 'check_every' iterations; 'niter' is then an upper
+        bound. The other arguments are
+        as in run_mcmc(). The chain holds the iterations run so far once the
+        run has ended: get_chain(), get_allocations() and the other methods
+        reading the run wait for it. A new run cancels this one.
+        """
+        if ess_target is None:
+            stop_on, ess_target = "", 0
+        elif ess_on in ("n_clusters", "log_likelihood"):
+            stop_on = ess_on
+        else:
             raise ValueError(
-                "'algorithm' parameter must be one of [{0}], found {1} instead".format(
-                    ", ".join(MARGINAL_ALGORITHMS + CONDITIONAL_ALGORITHMS),
-                    algorithm))
+                "'ess_on' must be 'n_clusters' or 'log_likelihood', "
+                "found {0} instead".format(ess_on))
+        self._setup_run(algorithm, out_file, record_allocations, density_grid,
+                        density_probs, store_chain, profile, trace_file,
+                        compress_chain, diagnostics)
+        self._handle = self._algo.run_async(
+            y, niter, nburn, rng_seed, thin, fields or [], stop_on,
+            ess_target, check_every)
+        return self._handle
+
+    def _setup_run(self, algorithm, out_file=None, record_allocations=False,
+                   density_grid=None, density_probs=(), store_chain=True,
+                   profile=False, trace_file=None, compress_chain=False,
+                   diagnostics=False):
+        self._check_algorithm(algorithm)
+        self._cancel_async()
         self.algo_name = algorithm
         self.algo_id = algorithm_id.AlgorithmId.Value(self.algo_name)
         self._algo = AlgorithmWrapper(
@@ -45,12 +214,333 @@ class MixtureModel(object):
         if self.hierarchy.NAME == 'PythonHier':
             self._algo.load_py_hier_implementation(self.hierarchy.hier_implementation)
 
+        self.out_file = out_file
+        if out_file is not None:
+            self._algo.set_output_file(out_file)
+        self._algo.set_record_allocations(record_allocations)
+        if density_grid is not None:
+            self._algo.set_online_density(
+                np.asarray(density_grid, dtype=float).reshape(
+                    len(density_grid), -1), list(density_probs))
+        self._algo.set_store_chain(store_chain)
+        self._algo.set_compression(
+            64 if compress_chain is True else int(compress_chain))
+        self._algo.set_diagnostics(diagnostics)
+        self._algo.set_profiling(profile)
+        if trace_file is not None:
+            self._algo.set_trace_file(trace_file)
+
+    def _join_async(self):
+        """Waits for the asynchronous run in progress, if any"""
+        if self._handle is not None:
+            self._handle.join()
+
+    def _cancel_async(self):
+        """Stops the asynchronous run in progress, if any, before a new run"""
+        if self._handle is not None:
+            self._handle.cancel()
+            self._handle.join()
+            self._handle = None
+
+    def checkpoint(self, path=None):
+        """Returns the state of the last run as bytes, see 'resume'. It
+        contains the last state of the algorithm (clusters, allocations,
+        mixing state and hyperparameters), the state of the random engine,
+        which Python hierarchies draw from as well, and the position in the
+        chain.
+
+        Parameters
+        ----------
+        path : str or None
+            If given, the checkpoint is also written to this file
+        """
+        self._join_async()
+        data = self._algo.checkpoint()
+        if path is not None:
+            with open(path, "wb") as f:
+                f.write(data)
+        return data
+
+    def resume(self, niter, y=None, checkpoint=None, out_file=None):
+        """Runs 'niter' more iterations, without burn-in, continuing the last
+        'run_mcmc' or 'resume' and appending to the same chain.
+
+        To continue a run saved by 'checkpoint', possibly in another process,
+        pass the checkpoint (bytes or a path) and the same data 'y'; the model
+        must have the same mixing, hierarchy and priors. If the chain was
+        streamed to a file, pass it again as 'out_file': the states saved after
+        the checkpoint are dropped and the new ones appended. A chain kept in
+        memory by another process is lost, only the new states are stored.
+        """
+        self._join_async()
+        if checkpoint is not None:
+            if y is None:
+                raise ValueError("'y' is needed to resume from a checkpoint")
+            if not isinstance(checkpoint, bytes):
+                with open(checkpoint, "rb") as f:
+                    checkpoint = f.read()
+            info = Checkpoint.from_bytes(checkpoint)
+            self.algo_name = info.algorithm
+            self.algo_id = algorithm_id.AlgorithmId.Value(self.algo_name)
+            self._algo = AlgorithmWrapper(
+                self.algo_name, self.hierarchy.NAME, self.mixing.NAME,
+                self.hierarchy.prior_params.SerializeToString(),
+                self.mixing.prior_proto.SerializeToString())
+            if self.hierarchy.NAME == 'PythonHier':
+                self._algo.load_py_hier_implementation(
+                    self.hierarchy.hier_implementation)
+            self.out_file = out_file
+            if out_file is not None:
+                self._algo.set_output_file(out_file)
+            self._algo.load_checkpoint(y, checkpoint)
+
+        with ostream_redirect(stdout=True, stderr=True):
+            self._algo.resume(niter)
+
+    def get_diagnostics(self):
+        """Returns the OnlineDiagnostics of the last run with 'diagnostics'
+        True, or None. They cover the number of clusters "n_clusters", the
+        log-likelihood of the data "log_likelihood" and the scalar parameters
+        of the mixing, named by their path in the mixing state, e.g.
+        "mixing.dp_state.totalmass" for the DP, over the saved iterations,
+        and can be queried while the run is in progress, e.g. from another
+        thread or during 'run_mcmc_async':
+
+            get_names(), get_size(name), get_trace(name)
+            ess(name, method="fft"): effective sample size, from the FFT
+                autocorrelations or, with method="batch_means", from batch
+                means updated while sampling
+            autocorrelation(name, max_lag=100)
+            split_rhat(name): split R-hat within the chain
+            summary(): {name: {"n", "mean", "sd", "ess", "ess_batch_means",
+                "split_rhat"}}
+
+        The chain is never deserialized. Every run has its own diagnostics,
+        which 'resume' extends.
+        """
+        return self._algo.get_diagnostics()
+
+    def get_profile(self):
+        """Returns the profile of the last 'run_mcmc' with 'profile' True, as
+        a dict mapping each phase (e.g. "iteration", "collector.collect",
+        "hierarchy.datum_move", "python.like_lpdf") to a dict with its number
+        of calls "count" and total time "seconds". Phases nest: the time of
+        "python.update_summary_statistics" is also in "hierarchy.datum_move".
+        """
+        self._join_async()
+        return self._algo.get_profile()
+
+    def run_chains(self, y, n_chains=4, algorithm="Neal2", niter=1000,
+                   nburn=500, seeds=None, n_jobs=None, diagnostics=False):
+        """Runs 'n_chains' independent chains in parallel, one per worker
+        process, each with its own random engine and collector. The data are
+        copied once to a shared memory block read by all the workers.
+
+        Parameters
+        ----------
+        y : array_like
+            The observed data
+        n_chains : int
+            Number of chains
+        algorithm, niter, nburn :
+            As in 'run_mcmc'
+        seeds : sequence of int or None
+            One strictly positive seed per chain, if None seeds are drawn
+            from numpy
+        n_jobs : int or None
+            Number of worker processes, defaults to 'n_chains'
+        diagnostics : bool
+            If True, every chain keeps the traces of the diagnostics of
+            'run_mcmc', which are compared across chains by
+            get_chains_diagnostics()
+        """
+        self._check_algorithm(algorithm)
+        self._cancel_async()
+        if seeds is None:
+            seeds = np.random.SeedSequence().generate_state(n_chains) % \
+                    (2 ** 31 - 1) + 1
+        if len(seeds) != n_chains:
+            raise ValueError(
+                "expected {0} seeds, found {1} instead".format(
+                    n_chains, len(seeds)))
+
+        self.algo_name = algorithm
+        self.algo_id = algorithm_id.AlgorithmId.Value(self.algo_name)
+        hier_impl = self.hierarchy.hier_implementation \
+            if self.hierarchy.NAME == 'PythonHier' else None
+        # The workers read the data from shared memory, so that they are
+        # not pickled once per chain
+        y = np.ascontiguousarray(y, dtype=np.float64)
+        shm = shared_memory.SharedMemory(create=True, size=max(y.nbytes, 1))
+        try:
+            np.ndarray(y.shape, dtype=np.float64, buffer=shm.buf)[...] = y
+            args = [(self.algo_name, self.hierarchy.NAME, self.mixing.NAME,
+                     self.hierarchy.prior_params.SerializeToString(),
+                     self.mixing.prior_proto.SerializeToString(),
+                     hier_impl, shm.name, y.shape, niter, nburn, int(seed),
+                     diagnostics)
+                    for seed in seeds]
+
+            with ProcessPoolExecutor(max_workers=n_jobs or n_chains) as pool:
+                results = list(pool.map(_run_chain, args))
+        finally:
+            shm.close()
+            shm.unlink()
+        self._serialized_chains = [(data, offsets)
+                                   for data, offsets, _ in results]
+        self._chain_traces = [traces for _, _, traces in results]
+
+    def run_sharded(self, y, n_shards=4, algorithm="Neal2", niter=1000,
+                    nburn=500, merge_niter=100, merge_nburn=0, seeds=None,
+                    n_jobs=None, out_file=None, record_allocations=False,
+                    thin=1, fields=None):
+        """Divide-and-conquer MCMC for large datasets. The data are split at
+        random in 'n_shards' shards of about the same size, and the sampler
+        runs on each shard in its own worker process, with its own random
+        engine. The clusters found in the shards are then put side by side and
+        a short run of 'merge_niter' iterations on the full data, started from
+        this partition, merges the clusters which describe the same
+        component. Only this last run is stored: get_chain() and
+        get_allocations() return it as after 'run_mcmc'. The mixing state and
+        the hyperparameters it starts from are those of the first shard.
+
+        Parameters
+        ----------
+        y : array_like
+            The observed data
+        n_shards : int
+            Number of shards
+        algorithm : str
+            One of the marginal algorithms: the merged partition has more
+            clusters than the fixed number of components of a conditional one
+        niter, nburn :
+            Iterations and burn-in of the runs on the shards
+        merge_niter, merge_nburn :
+            Iterations and burn-in of the run on the full data; its first
+            iterations already reallocate every datum across all clusters
+        seeds : sequence of int or None
+            One strictly positive seed per shard, followed by the seed of the
+            random split of the data and the seed of the full data run, so
+            'n_shards' + 2 seeds; if None seeds are drawn from numpy
+        n_jobs : int or None
+            Number of worker processes, defaults to 'n_shards'
+        out_file, record_allocations, thin, fields :
+            As in 'run_mcmc', for the run on the full data
+        """
+        if algorithm not in MARGINAL_ALGORITHMS:
+            raise ValueError(
+                "'algorithm' parameter must be one of [{0}], found {1} instead".format(
+                    ", ".join(MARGINAL_ALGORITHMS), algorithm))
+        y = np.asarray(y, dtype=float)
+        if not 1 <= n_shards <= len(y):
+            raise ValueError(
+                "'n_shards' must be between 1 and the number of data {0}, "
+                "found {1} instead".format(len(y), n_shards))
+        if seeds is None:
+            seeds = np.random.SeedSequence().generate_state(n_shards + 2) % \
+                    (2 ** 31 - 1) + 1
+        if len(seeds) != n_shards + 2:
+            raise ValueError(
+                "expected {0} seeds, found {1} instead".format(
+                    n_shards + 2, len(seeds)))
+
+        self._setup_run(algorithm, out_file, record_allocations)
+
+        shards = np.array_split(
+            np.random.default_rng(int(seeds[-2])).permutation(len(y)), n_shards)
+
+        hier_prior = self.hierarchy.prior_params.SerializeToString()
+        mix_prior = self.mixing.prior_proto.SerializeToString()
+        hier_impl = self.hierarchy.hier_implementation \
+            if self.hierarchy.NAME == 'PythonHier' else None
+        args = [(self.algo_name, self.hierarchy.NAME, self.mixing.NAME,
+                 hier_prior, mix_prior, hier_impl, y[shard], niter, nburn,
+                 int(seed)) for shard, seed in zip(shards, seeds[:-2])]
+
+        with ProcessPoolExecutor(max_workers=n_jobs or n_shards) as pool:
+            shard_states = [AlgorithmState.FromString(state)
+                            for state in pool.map(_run_shard, args)]
+        merged = _merge_shard_states(shard_states, shards, len(y))
+
         with ostream_redirect(stdout=True, stderr=True):
-            self._algo.run(y, niter, nburn, rng_seed)
+            self._algo.run_from_state(
+                y, merged.SerializeToString(), merge_niter, merge_nburn,
+                int(seeds[-1]), thin, fields or [])
 
     def get_chain(self, optimize_memory=False):
-        deserialize = not optimize_memory
+        """Returns the chain of the last run as an MCMCchain. The chain is a
+        view on the states stored by the run, in memory or in 'out_file', so
+        getting it is O(1): states are decoded only when accessed. With
+        'optimize_memory' the decoded states and the extracted parameters are
+        not cached."""
+        self._join_async()
+        cache = not optimize_memory
+
+        if self.out_file is not None:
+            return MCMCchain(MmapChain(self.out_file), AlgorithmState, False,
+                             collector=self._algo.get_file_collector(),
+                             cache=cache)
+
+        collector = self._algo.get_collector()
+        compressed = collector.get_compressed_chain()
+        if compressed is not None:
+            return MCMCchain(compressed, AlgorithmState, False,
+                             collector=compressed, cache=cache)
+
+        chain = BufferChain(collector.get_chain_buffer(),
+                            collector.get_chain_offsets())
+        return MCMCchain(chain, AlgorithmState, False, collector=collector,
+                         cache=cache)
+
+    def save_compressed_chain(self, path):
+        """Writes the chain of the last 'run_mcmc' with 'compress_chain' to
+        'path', to be read back by load_compressed_chain()."""
+        self._join_async()
+        compressed = self._algo.get_collector().get_compressed_chain()
+        if compressed is None:
+            raise ValueError("the last run did not use 'compress_chain'")
+        compressed.save(path)
+
+    def get_allocations(self):
+        """Returns the cluster allocations of the last 'run_mcmc' as a
+        (n_iter, n_data) int32 numpy array. If the allocations were recorded
+        while sampling the array is a read-only view on the recorded matrix,
+        which it keeps alive, so it stays valid after later runs and resumes;
+        otherwise they are extracted from the chain.
+        """
+        self._join_async()
+        collector = self._algo.get_collector()
+        if collector.is_recording_allocations():
+            return collector.get_allocations()
+        return collector.extract_field("cluster_allocs").astype(np.int32)
 
-        return MCMCchain(
-            self._algo.get_collector().get_serialized_chain(),
-            AlgorithmState, deserialize)
+    def get_chains(self, optimize_memory=False):
+        """Returns the list of MCMCchain produced by 'run_chains', see
+        get_chain"""
+        return [MCMCchain(BufferChain(data, offsets), AlgorithmState, False,
+                          cache=not optimize_memory)
+                for data, offsets in self._serialized_chains]
+
+    def get_chains_diagnostics(self):
+        """Compares the chains of the last 'run_chains' with 'diagnostics'
+        True. Returns a dict mapping every summary of get_diagnostics() to a
+        dict with the split R-hat across all the chains "split_rhat" and the
+        total effective sample size "ess", computed in C++ on the traces
+        kept while sampling."""
+        if not self._chain_traces or self._chain_traces[0] is None:
+            raise ValueError("the last 'run_chains' did not use 'diagnostics'")
+        out = {}
+        for name in self._chain_traces[0]:
+            traces = [chain[name] for chain in self._chain_traces]
+            out[name] = {
+                "split_rhat": split_rhat(traces),
+                "ess": sum(effective_sample_size(t) for t in traces)}
+        return out
+
+    @staticmethod
+    def _check_algorithm(algorithm):
+        if algorithm not in (MARGINAL_ALGORITHMS + CONDITIONAL_ALGORITHMS):
+            raise ValueError(
+                "'algorithm' parameter must be one of [{0}], found {1} instead".format(
+                    ", ".join(MARGINAL_ALGORITHMS + CONDITIONAL_ALGORITHMS),
+                    algorithm))
@@ -0,0 +1,105 @@
+#ifndef PYBMIX_ALGORITHM_ACCESS_
+#define PYBMIX_ALGORITHM_ACCESS_
+
+#include <vector>
+
+#include "algorithm_state.pb.h"
+#include "bayesmix/src/algorithms/base_algorithm.h"
+#include "bayesmix/src/collectors/memory_collector.h"
+
+//! Gives AlgorithmWrapper access to the protected steps of a BaseAlgorithm,
+//! so that it can drive the algorithm itself instead of going through run()
+//! and eval_lpdf(). Never instantiated: the members are reached through
+//! pointers to members of BaseAlgorithm formed in the derived class, hence
+//! the static functions must not hide their names.
+struct AlgorithmAccess : public BaseAlgorithm {
+    //! Loads the next state of the collector into the algorithm, returns
+    //! false at the end of the chain
+    static bool load_state(BaseAlgorithm &algo, BaseCollector *collector) {
+        return (algo.*(&AlgorithmAccess::update_state_from_collector))(collector);
+    }
+
+    //! Sets the data of the algorithm as set_data() does, but assigning
+    //! `data` (e.g. a row-major view on a numpy array) straight into its
+    //! column-major matrix, without an intermediate Eigen::MatrixXd
+    template <typename Derived>
+    static void assign_data(BaseAlgorithm &algo, const Eigen::MatrixBase<Derived> &data) {
+        (algo.*(&AlgorithmAccess::data)) = data;
+    }
+
+    //! Sets the state read by lpdf_from_state, which bayesmix fills only in
+    //! update_state_from_collector, leaving the sampler untouched
+    static void set_curr_state(BaseAlgorithm &algo,
+                               const bayesmix::AlgorithmState &state) {
+        (algo.*(&AlgorithmAccess::curr_state)).CopyFrom(state);
+    }
+
+    //! Log density of the mixture in the state loaded by load_state or
+    //! set_curr_state on the grid
+    static Eigen::VectorXd eval_lpdf_from_state(BaseAlgorithm &algo,
+                                                const Eigen::MatrixXd &grid) {
+        return (algo.*(&AlgorithmAccess::lpdf_from_state))(
+                grid, Eigen::RowVectorXd(0), Eigen::RowVectorXd(0));
+    }
+
+    //! Initializes the algorithm as run() does before the first iteration
+    static void initialize_algorithm(BaseAlgorithm &algo) {
+        (algo.*(&AlgorithmAccess::initialize))();
+    }
+
+    //! Runs one iteration of the algorithm
+    static void run_step(BaseAlgorithm &algo) { (algo.*(&AlgorithmAccess::step))(); }
+
+    static unsigned int num_clusters(BaseAlgorithm &algo) {
+        return (algo.*(&AlgorithmAccess::unique_values)).size();
+    }
+
+    //! Log-likelihood of the data given the allocations and the cluster
+    //! parameters of the current state. The data of every cluster are
+    //! gathered and evaluated by one like_lpdf_grid call, a single call into
+    //! Python per cluster for Python hierarchies.
+    static double log_likelihood(BaseAlgorithm &algo) {
+        const auto &unique_values = algo.*(&AlgorithmAccess::unique_values);
+        const auto &allocations = algo.*(&AlgorithmAccess::allocations);
+        const Eigen::MatrixXd &data = algo.*(&AlgorithmAccess::data);
+        std::vector<std::vector<int>> members(unique_values.size());
+        for (int i = 0; i < data.rows(); i++) members[allocations[i]].push_back(i);
+        double out = 0;
+        Eigen::MatrixXd rows;
+        for (size_t c = 0; c < members.size(); c++) {
+            if (members[c].empty()) continue;
+            rows.resize(members[c].size(), data.cols());
+            for (size_t k = 0; k < members[c].size(); k++) {
+                rows.row(k) = data.row(members[c][k]);
+            }
+            out += unique_values[c]->like_lpdf_grid(rows).sum();
+        }
+        return out;
+    }
+
+    static bayesmix::AlgorithmState current_state(BaseAlgorithm &algo) {
+        return (algo.*(&AlgorithmAccess::get_state_as_proto))();
+    }
+
+    //! Sets an initialized algorithm to `state` and adds every datum back to
+    //! its cluster, so that the cluster statistics are as during sampling
+    static void restore_state(BaseAlgorithm &algo, bayesmix::AlgorithmState state) {
+        // Cardinalities are rebuilt by adding the data back
+        for (auto &cluster: *state.mutable_cluster_states()) cluster.set_cardinality(0);
+        MemoryCollector source;
+        source.start_collecting();
+        source.collect(state);
+        source.finish_collecting();
+        load_state(algo, &source);
+
+        auto &unique_values = algo.*(&AlgorithmAccess::unique_values);
+        const auto &allocations = algo.*(&AlgorithmAccess::allocations);
+        const Eigen::MatrixXd &data = algo.*(&AlgorithmAccess::data);
+        bool update_params = (algo.*(&AlgorithmAccess::update_hierarchy_params))();
+        for (int i = 0; i < data.rows(); i++) {
+            unique_values[allocations[i]]->add_datum(i, data.row(i), update_params);
+        }
+    }
+};
+
+#endif
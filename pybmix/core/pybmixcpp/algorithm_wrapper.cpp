@@ -1,7 +1,56 @@
 #include "algorithm_wrapper.hpp"
 
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+
+#include "algorithm_access.hpp"
 #include "hierarchy_prior.pb.h"
 
+namespace {
+const char ASYNC_RUN_IN_PROGRESS[] =
+        "An asynchronous run is in progress: join its handle first";
+
+//! bayesmix draws all random numbers from the process-wide Rng singleton, so
+//! two samplers must never run at the same time in one process
+std::mutex run_mutex;
+
+//! Locks run_mutex, releasing the GIL while waiting if this thread holds
+//! it: the run in progress may be one of run_async needing the GIL
+std::unique_lock<std::mutex> lock_run() {
+    std::unique_lock<std::mutex> lock(run_mutex, std::try_to_lock);
+    if (lock.owns_lock()) return lock;
+    if (PyGILState_Check()) {
+        pybind11::gil_scoped_release release;
+        lock.lock();
+    } else {
+        lock.lock();
+    }
+    return lock;
+}
+
+//! Throws unless 0 <= burnin <= niter and thin > 0, which size the collector
+void check_run_args(int niter, int burnin, unsigned int thin) {
+    if (burnin < 0 || burnin > niter) {
+        throw std::invalid_argument("'burnin' must be in [0, niter]");
+    }
+    if (thin == 0) throw std::invalid_argument("'thin' must be positive");
+}
+
+//! Stops the profiler when a profiled run ends, even with an exception
+struct ProfilingSession {
+    bool active;
+
+    ProfilingSession(bool active, bool trace) : active(active) {
+        if (active) Profiler::Instance().start(trace);
+    }
+
+    ~ProfilingSession() {
+        if (active) Profiler::Instance().stop();
+    }
+};
+}  // namespace
+
 AlgorithmWrapper::AlgorithmWrapper(const std::string &algo_type,
                                    const std::string &hier_type,
                                    const std::string &mix_type,
@@ -19,8 +68,190 @@ AlgorithmWrapper::AlgorithmWrapper(const std::string &algo_type,
     }
 }
 
-void AlgorithmWrapper::run(const Eigen::MatrixXd &data, int niter, int burnin,
-                           int rng_seed) {
+void AlgorithmWrapper::run(const Eigen::Ref<const DataMatrix> &data, int niter,
+                           int burnin, int rng_seed, unsigned int thin,
+                           const std::vector <std::string> &fields) {
+    namespace py = pybind11;
+    check_idle();
+    check_run_args(niter, burnin, thin);
+    // C++ and native hierarchies never call into Python while sampling:
+    // release the GIL so that other Python threads can make progress
+    std::unique_ptr<py::gil_scoped_release> release;
+    if (!needs_gil()) release = std::make_unique<py::gil_scoped_release>();
+    auto lock = lock_run();
+
+    ProfilingSession session(profiling, !trace_file.empty());
+    {
+        ScopedTimer run_timer(Profiler::Run);
+        {
+            ScopedTimer init_timer(Profiler::Initialize);
+            prepare_algorithm(data, niter, burnin, rng_seed);
+            setup_collector(thin, fields, (niter - burnin + thin - 1) / thin,
+                            data.rows());
+        }
+        algo->run(&collector);
+    }
+    n_iter_done = 0;
+    save_run_state(niter);
+    finish_profiling();
+}
+
+void AlgorithmWrapper::run_from_state(const Eigen::Ref<const DataMatrix> &data,
+                                      const std::string &initial_state,
+                                      int niter, int burnin, int rng_seed,
+                                      unsigned int thin,
+                                      const std::vector <std::string> &fields) {
+    namespace py = pybind11;
+    check_idle();
+    check_run_args(niter, burnin, thin);
+    bayesmix::AlgorithmState state;
+    if (!state.ParseFromString(initial_state)) {
+        throw std::invalid_argument("Corrupted initial state");
+    }
+    if (state.cluster_allocs_size() != data.rows()) {
+        throw std::invalid_argument(
+                "The initial state has " + std::to_string(state.cluster_allocs_size()) +
+                " allocations, expected one per datum (" + std::to_string(data.rows()) +
+                ")");
+    }
+
+    std::unique_ptr<py::gil_scoped_release> release;
+    if (!needs_gil()) release = std::make_unique<py::gil_scoped_release>();
+    auto lock = lock_run();
+
+    ProfilingSession session(profiling, !trace_file.empty());
+    {
+        ScopedTimer run_timer(Profiler::Run);
+        {
+            ScopedTimer init_timer(Profiler::Initialize);
+            prepare_algorithm(data, niter, burnin, rng_seed);
+            AlgorithmAccess::initialize_algorithm(*algo);
+            AlgorithmAccess::restore_state(*algo, state);
+            setup_collector(thin, fields, (niter - burnin + thin - 1) / thin,
+                            data.rows());
+        }
+        collector.start_collecting();
+        for (int i = 0; i < niter; i++) {
+            AlgorithmAccess::run_step(*algo);
+            if (i >= burnin) collector.collect(AlgorithmAccess::current_state(*algo));
+        }
+        collector.finish_collecting();
+    }
+    n_iter_done = 0;
+    save_run_state(niter);
+    finish_profiling();
+}
+
+std::shared_ptr<RunHandle> AlgorithmWrapper::run_async(
+        const Eigen::Ref<const DataMatrix> &data, int niter, int burnin,
+        int rng_seed, unsigned int thin, const std::vector<std::string> &fields,
+        const RunHandle::StopRule &rule) {
+    check_run_args(niter, burnin, thin);
+    if (rule.statistic != RunHandle::StopRule::Statistic::None &&
+        rule.check_every == 0) {
+        throw std::invalid_argument("'check_every' must be positive");
+    }
+    // Claimed before touching the algorithm, so that two threads calling
+    // run_async at once can not both start
+    bool expected = false;
+    if (!running.compare_exchange_strong(expected, true)) {
+        throw std::runtime_error(ASYNC_RUN_IN_PROGRESS);
+    }
+    std::shared_ptr<RunHandle> handle;
+    try {
+        handle = std::make_shared<RunHandle>(niter, rule);
+        {
+            auto lock = lock_run();
+            // The worker may outlive `data`: the algorithm keeps its own copy
+            prepare_algorithm(data, niter, burnin, -1);
+            setup_collector(thin, fields, (niter - burnin + thin - 1) / thin,
+                            data.rows());
+        }
+        collector.set_busy(true);
+        start_worker(handle.get(), niter, burnin, rng_seed);
+    } catch (...) {
+        collector.set_busy(false);
+        running = false;
+        throw;
+    }
+    return handle;
+}
+
+void AlgorithmWrapper::start_worker(RunHandle *h, int niter, int burnin,
+                                    int rng_seed) {
+    // The handle joins the worker when destroyed, so it outlives it
+    h->set_thread(std::thread([this, h, niter, burnin, rng_seed]() {
+        namespace py = pybind11;
+        using Statistic = RunHandle::StopRule::Statistic;
+        const Statistic statistic = h->get_stop_rule().statistic;
+        RunHandle::Status status = RunHandle::Status::Finished;
+        std::exception_ptr error;
+        int n_run = 0;
+        try {
+            auto lock = lock_run();
+            // Seeded here, since other runs may have used the engine meanwhile
+            if (rng_seed > 0) bayesmix::Rng::Instance().get().seed(rng_seed);
+
+            // Python hierarchies: held for the whole run, which is cheaper
+            // than a new thread state at every iteration, and released
+            // between iterations so that Python threads can poll the handle
+            std::unique_ptr<py::gil_scoped_acquire> gil;
+            if (needs_gil()) gil = std::make_unique<py::gil_scoped_acquire>();
+
+            ProfilingSession session(profiling, !trace_file.empty());
+            {
+                ScopedTimer run_timer(Profiler::Run);
+                {
+                    ScopedTimer init_timer(Profiler::Initialize);
+                    AlgorithmAccess::initialize_algorithm(*algo);
+                }
+                collector.start_collecting();
+                while (n_run < niter) {
+                    if (gil) {
+                        // Hands the GIL over to the Python threads waiting
+                        // for it, e.g. to poll or cancel the handle
+                        py::gil_scoped_release release;
+                        std::this_thread::yield();
+                    }
+                    if (h->is_cancel_requested()) {
+                        status = RunHandle::Status::Cancelled;
+                        break;
+                    }
+                    AlgorithmAccess::run_step(*algo);
+                    if (n_run >= burnin) {
+                        collector.collect(AlgorithmAccess::current_state(*algo));
+                    }
+                    bool converged = false;
+                    if (n_run >= burnin && statistic != Statistic::None) {
+                        double value = statistic == Statistic::NumClusters ?
+                                       AlgorithmAccess::num_clusters(*algo) :
+                                       AlgorithmAccess::log_likelihood(*algo);
+                        converged = h->add_statistic(value);
+                    }
+                    n_run++;
+                    h->iteration_done();
+                    if (converged) {
+                        status = RunHandle::Status::Converged;
+                        break;
+                    }
+                }
+                collector.finish_collecting();
+            }
+            n_iter_done = 0;
+            save_run_state(n_run);
+            finish_profiling();
+        } catch (...) {
+            status = RunHandle::Status::Failed;
+            error = std::current_exception();
+        }
+        collector.set_busy(false);
+        running = false;
+        h->finish(status, error);
+    }));
+}
+
+void AlgorithmWrapper::prepare_algorithm(const Eigen::Ref<const DataMatrix> &data,
+                                         int niter, int burnin, int rng_seed) {
     hier->initialize();
     if (rng_seed > 0) {
         auto &rng = bayesmix::Rng::Instance().get();
@@ -32,10 +263,203 @@ void AlgorithmWrapper::run(const Eigen::MatrixXd &data, int niter, int burnin,
     algo->read_params_from_proto(algo_params);
 
     algo->set_mixing(mixing);
-    algo->set_data(data);
+    // The algorithm keeps its own column-major copy of the data: fill it
+    // from the caller's buffer directly, which is the only copy of the data
+    AlgorithmAccess::assign_data(*algo, data);
     algo->set_hierarchy(hier);
+}
+
+void AlgorithmWrapper::setup_collector(unsigned int thin,
+                                       const std::vector<std::string> &fields,
+                                       unsigned int n_states, unsigned int n_data) {
+    collector.set_thinning(thin);
+    collector.set_field_mask(fields);
+    run_fields = fields;
+
+    if (diagnostics) {
+        // The algorithm is in the collected state when the collector is called
+        collector.set_diagnostics(true, [this]() {
+            return AlgorithmAccess::log_likelihood(*algo);
+        });
+    } else {
+        collector.set_diagnostics(false);
+    }
+
+    if (online_grid.rows() > 0) {
+        online_density = DensityReduction(online_grid.rows(), online_probs);
+        // lpdf_from_state reads the state of the last load_state, which
+        // sampling never updates: evaluate the collected state instead
+        collector.set_callback([this](const google::protobuf::Message &state) {
+            AlgorithmAccess::set_curr_state(
+                    *algo, google::protobuf::internal::down_cast<
+                            const bayesmix::AlgorithmState &>(state));
+            reduce_density(online_grid, 256, &online_density);
+        });
+    } else {
+        collector.set_callback(nullptr);
+    }
+
+    if (record_allocs) {
+        collector.record_allocations(n_states, n_data);
+    } else {
+        collector.clear_allocations();
+    }
+}
+
+void AlgorithmWrapper::finish_profiling() {
+    if (!profiling) return;
+    Profiler::Instance().stop();
+    profile = Profiler::Instance().snapshot();
+    if (!trace_file.empty()) {
+        Profiler::Instance().write_trace(trace_file);
+        trace_file.clear();
+    }
+}
+
+void AlgorithmWrapper::save_run_state(uint64_t n_iter) {
+    last_state = AlgorithmAccess::current_state(*algo).SerializeAsString();
+    std::ostringstream rng;
+    rng << bayesmix::Rng::Instance().get();
+    rng_state = rng.str();
+    n_iter_done += n_iter;
+    resumable = true;
+    algo_in_sync = true;
+}
+
+std::string AlgorithmWrapper::checkpoint() const {
+    check_idle();
+    if (!resumable) throw std::runtime_error("Nothing to checkpoint: call run() first");
+    Checkpoint out;
+    out.algorithm = bayesmix::AlgorithmId_Name(algo->get_id());
+    out.hierarchy = bayesmix::HierarchyId_Name(hier->get_id());
+    out.mixing = bayesmix::MixingId_Name(mixing->get_id());
+    out.n_iter = n_iter_done;
+    out.n_seen = collector.get_n_seen();
+    out.n_stored = collector.get_size();
+    out.thin = collector.get_thinning();
+    out.fields = run_fields;
+    out.state = last_state;
+    out.rng = rng_state;
+    return out.serialize();
+}
+
+void AlgorithmWrapper::load_checkpoint(const Eigen::Ref<const DataMatrix> &data,
+                                       const std::string &checkpoint) {
+    namespace py = pybind11;
+    check_idle();
+    Checkpoint ckpt = Checkpoint::parse(checkpoint);
+    std::string expected = bayesmix::AlgorithmId_Name(algo->get_id()) + "/" +
+                           bayesmix::HierarchyId_Name(hier->get_id()) + "/" +
+                           bayesmix::MixingId_Name(mixing->get_id());
+    std::string found = ckpt.algorithm + "/" + ckpt.hierarchy + "/" + ckpt.mixing;
+    if (found != expected) {
+        throw std::invalid_argument("Checkpoint of a " + found + " run, expected " +
+                                    expected);
+    }
+    bayesmix::AlgorithmState state;
+    if (!state.ParseFromString(ckpt.state)) {
+        throw std::invalid_argument("Corrupted algorithm state in the checkpoint");
+    }
+
+    std::unique_ptr<py::gil_scoped_release> release;
+    if (!needs_gil()) release = std::make_unique<py::gil_scoped_release>();
+    auto lock = lock_run();
+
+    prepare_algorithm(data, ckpt.n_iter, 0, -1);
+    AlgorithmAccess::initialize_algorithm(*algo);
+    AlgorithmAccess::restore_state(*algo, state);
+
+    setup_collector(ckpt.thin, ckpt.fields, 0, data.rows());
+    collector.resume_collecting(ckpt.n_seen, ckpt.n_stored);
+    collector.finish_collecting();
+
+    resumable = true;
+    algo_in_sync = true;
+    n_iter_done = ckpt.n_iter;
+    last_state = ckpt.state;
+    rng_state = ckpt.rng;
+}
+
+void AlgorithmWrapper::resume(unsigned int n_iter) {
+    namespace py = pybind11;
+    check_idle();
+    if (!resumable) {
+        throw std::runtime_error(
+                "Nothing to resume: call run() or load_checkpoint() first");
+    }
+    std::unique_ptr<py::gil_scoped_release> release;
+    if (!needs_gil()) release = std::make_unique<py::gil_scoped_release>();
+    auto lock = lock_run();
+
+    ProfilingSession session(profiling, !trace_file.empty());
+    {
+        ScopedTimer run_timer(Profiler::Run);
+        if (!algo_in_sync) {
+            bayesmix::AlgorithmState state;
+            state.ParseFromString(last_state);
+            AlgorithmAccess::restore_state(*algo, state);
+        }
+        std::istringstream(rng_state) >> bayesmix::Rng::Instance().get();
+        collector.resume_collecting(collector.get_n_seen(), collector.get_size());
+        for (unsigned int i = 0; i < n_iter; i++) {
+            AlgorithmAccess::run_step(*algo);
+            collector.collect(AlgorithmAccess::current_state(*algo));
+        }
+        collector.finish_collecting();
+    }
+    save_run_state(n_iter);
+    finish_profiling();
+}
+
+DensityReduction AlgorithmWrapper::eval_density_summary(
+        const Eigen::Ref<const DataMatrix> &grid, const std::vector<double> &probs,
+        int block_size) {
+    namespace py = pybind11;
+    check_idle();
+    if (block_size <= 0) throw std::invalid_argument("'block_size' must be positive");
+    // Python hierarchies evaluate the grid with the GIL held
+    std::unique_ptr<py::gil_scoped_release> release;
+    if (!needs_gil()) release = std::make_unique<py::gil_scoped_release>();
+
+    algo_in_sync = false;
+    DensityReduction out(grid.rows(), probs);
+    while (AlgorithmAccess::load_state(*algo, &collector)) {
+        reduce_density(grid, block_size, &out);
+    }
+    return out;
+}
+
+void AlgorithmWrapper::reduce_density(const Eigen::Ref<const DataMatrix> &grid,
+                                      int block_size, DensityReduction *out) {
+    const int n_grid = grid.rows();
+    for (int start = 0; start < n_grid; start += block_size) {
+        Eigen::MatrixXd block = grid.middleRows(start, std::min(block_size, n_grid - start));
+        out->add(start, AlgorithmAccess::eval_lpdf_from_state(*algo, block));
+    }
+    out->next_iteration();
+}
+
+pybind11::dict AlgorithmWrapper::get_profile() const {
+    namespace py = pybind11;
+    check_idle();
+    py::dict out;
+    for (size_t p = 0; p < profile.size(); p++) {
+        if (profile[p].count == 0) continue;
+        py::dict stat;
+        stat["count"] = profile[p].count;
+        stat["seconds"] = profile[p].total_ns * 1e-9;
+        out[Profiler::name(static_cast<Profiler::Phase>(p))] = stat;
+    }
+    return out;
+}
+
+void AlgorithmWrapper::check_idle() const {
+    if (running) throw std::runtime_error(ASYNC_RUN_IN_PROGRESS);
+}
 
-    algo->run(&collector);
+bool AlgorithmWrapper::needs_gil() const {
+    auto *python_hier = dynamic_cast<PythonHierarchy *>(hier.get());
+    return python_hier != nullptr && !python_hier->is_native();
 }
 
 void AlgorithmWrapper::say_hello() {
@@ -43,6 +467,7 @@ void AlgorithmWrapper::say_hello() {
 }
 
 void AlgorithmWrapper::load_py_hier_implementation(const std::string &module_name) {
+    check_idle();
     if (dynamic_cast<PythonHierarchy *>(hier.get()) != nullptr) {
         static_cast<PythonHierarchy *>(hier.get())->set_module(module_name.c_str());
     }
@@ -55,8 +480,70 @@ void add_algorithm_wrapper(pybind11::module &m) {
             .def(py::init<const std::string &, const std::string &, const std::string &,
                     const std::string &, const std::string &>())
             .def("say_hello", &AlgorithmWrapper::say_hello)
-            .def("run", &AlgorithmWrapper::run)
+            .def("run", &AlgorithmWrapper::run, py::arg("data"), py::arg("niter"),
+                 py::arg("burnin"), py::arg("rng_seed") = -1, py::arg("thin") = 1,
+                 py::arg("fields") = std::vector<std::string>())
+            .def("run_from_state", [](AlgorithmWrapper &self,
+                                      const Eigen::Ref<const AlgorithmWrapper::DataMatrix> &data,
+                                      const py::bytes &initial_state, int niter,
+                                      int burnin, int rng_seed, unsigned int thin,
+                                      const std::vector<std::string> &fields) {
+                     self.run_from_state(data, initial_state, niter, burnin,
+                                         rng_seed, thin, fields);
+                 }, py::arg("data"), py::arg("initial_state"), py::arg("niter"),
+                 py::arg("burnin"), py::arg("rng_seed") = -1, py::arg("thin") = 1,
+                 py::arg("fields") = std::vector<std::string>())
+            .def("run_async", [](AlgorithmWrapper &self,
+                                 const Eigen::Ref<const AlgorithmWrapper::DataMatrix> &data,
+                                 int niter, int burnin, int rng_seed, unsigned int thin,
+                                 const std::vector<std::string> &fields,
+                                 const std::string &stop_on, double target_ess,
+                                 unsigned int check_every) {
+                     using Statistic = RunHandle::StopRule::Statistic;
+                     RunHandle::StopRule rule;
+                     if (stop_on == "n_clusters") {
+                         rule.statistic = Statistic::NumClusters;
+                     } else if (stop_on == "log_likelihood") {
+                         rule.statistic = Statistic::LogLikelihood;
+                     } else if (!stop_on.empty()) {
+                         throw std::invalid_argument(
+                                 "'stop_on' must be 'n_clusters' or 'log_likelihood'");
+                     }
+                     rule.target_ess = target_ess;
+                     rule.check_every = check_every;
+                     return self.run_async(data, niter, burnin, rng_seed, thin,
+                                           fields, rule);
+                 }, py::arg("data"), py::arg("niter"), py::arg("burnin"),
+                 py::arg("rng_seed") = -1, py::arg("thin") = 1,
+                 py::arg("fields") = std::vector<std::string>(),
+                 py::arg("stop_on") = "", py::arg("target_ess") = 0,
+                 py::arg("check_every") = 100, py::keep_alive<0, 1>())
             .def("eval_density", &AlgorithmWrapper::eval_density)
-            .def("get_collector", &AlgorithmWrapper::get_collector)
+            .def("eval_density_summary", &AlgorithmWrapper::eval_density_summary,
+                 py::arg("grid"), py::arg("probs"), py::arg("block_size") = 256)
+            .def("get_collector", &AlgorithmWrapper::get_collector,
+                 py::return_value_policy::reference_internal)
+            .def("set_output_file", &AlgorithmWrapper::set_output_file)
+            .def("get_file_collector", &AlgorithmWrapper::get_file_collector)
+            .def("set_record_allocations", &AlgorithmWrapper::set_record_allocations)
+            .def("set_online_density", &AlgorithmWrapper::set_online_density)
+            .def("get_online_density", &AlgorithmWrapper::get_online_density,
+                 py::return_value_policy::reference_internal)
+            .def("set_store_chain", &AlgorithmWrapper::set_store_chain)
+            .def("set_compression", &AlgorithmWrapper::set_compression)
+            .def("checkpoint", [](const AlgorithmWrapper &self) {
+                return py::bytes(self.checkpoint());
+            })
+            .def("load_checkpoint", [](AlgorithmWrapper &self,
+                                       const Eigen::Ref<const AlgorithmWrapper::DataMatrix> &data,
+                                       const py::bytes &checkpoint) {
+                self.load_checkpoint(data, checkpoint);
+            })
+            .def("resume", &AlgorithmWrapper::resume, py::arg("n_iter"))
+            .def("set_diagnostics", &AlgorithmWrapper::set_diagnostics)
+            .def("get_diagnostics", &AlgorithmWrapper::get_diagnostics)
+            .def("set_profiling", &AlgorithmWrapper::set_profiling)
+            .def("set_trace_file", &AlgorithmWrapper::set_trace_file)
+            .def("get_profile", &AlgorithmWrapper::get_profile)
             .def("load_py_hier_implementation", &AlgorithmWrapper::load_py_hier_implementation);
 }
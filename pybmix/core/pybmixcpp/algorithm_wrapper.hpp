@@ -8,11 +8,90 @@
 
 #include "bayesmix/src/includes.h"
 #include "python_embedding/includes.h"
+#include "checkpoint.hpp"
+#include "density_reduction.hpp"
+#include "file_collector.hpp"
+#include "profiler.hpp"
+#include "run_handle.hpp"
 #include "serialized_collector.hpp"
 
 class AlgorithmWrapper {
+public:
+    //! Layout of C-ordered numpy arrays, which bind to a const reference to
+    //! DataMatrix without a copy
+    using DataMatrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+            Eigen::RowMajor>;
+
 protected:
     SerializedCollector collector;
+    //! Whether the next runs record the allocations in a dense matrix
+    bool record_allocs = false;
+    //! If not empty, the density on this grid is reduced during the runs
+    DataMatrix online_grid;
+    std::vector<double> online_probs;
+    DensityReduction online_density;
+    //! Whether the next runs maintain OnlineDiagnostics, see get_diagnostics
+    bool diagnostics = false;
+    //! Whether the next runs are profiled, see get_profile
+    bool profiling = false;
+    //! If not empty, the trace events of the next run are written here
+    std::string trace_file;
+    //! Statistics of the phases of the last profiled run, indexed by
+    //! Profiler::Phase
+    std::vector<Profiler::Stat> profile;
+
+    //! Whether there is a run which can be resumed
+    bool resumable = false;
+    //! Serialized AlgorithmState at the end of the last run or resume.
+    //! Density evaluations replay the chain through the algorithm, which is
+    //! then out of sync with it until the next resume.
+    std::string last_state;
+    bool algo_in_sync = false;
+    //! Iterations run so far, burn-in included
+    uint64_t n_iter_done = 0;
+    std::vector<std::string> run_fields;
+    //! State of the random engine at the end of the last run or resume, so
+    //! that runs of other wrappers in between do not change the stream
+    std::string rng_state;
+    //! Whether a run started by run_async is in progress; the wrapper must
+    //! not be used until it ends
+    std::atomic<bool> running{false};
+
+    //! Throws if a run started by run_async is in progress
+    void check_idle() const;
+
+    //! Initializes the hierarchy, seeds the random engine if `rng_seed` is
+    //! positive and hands data, mixing and hierarchy to the algorithm
+    void prepare_algorithm(const Eigen::Ref<const DataMatrix> &data, int niter,
+                           int burnin, int rng_seed);
+
+    //! Sets thinning, field mask, allocation recording (with room for
+    //! `n_states` states), diagnostics and online density callback of the
+    //! collector
+    void setup_collector(unsigned int thin, const std::vector<std::string> &fields,
+                         unsigned int n_states, unsigned int n_data);
+
+    //! Starts the thread of run_async, which runs the algorithm prepared by
+    //! it, reports to `h` and clears `running` at the end
+    void start_worker(RunHandle *h, int niter, int burnin, int rng_seed);
+
+    //! Reads the profile of a run from Profiler and writes the trace, if any
+    void finish_profiling();
+
+    //! Saves the states of the algorithm and of the random engine at the end
+    //! of a run, after `n_iter` more iterations
+    void save_run_state(uint64_t n_iter);
+
+    //! Evaluates the density of the current state of the algorithm on the
+    //! grid, one block of `block_size` points at a time. Blocks are evaluated
+    //! serially: lpdf_from_state sets the state of the mixing and of the
+    //! hierarchies of the algorithm, which are shared.
+    void reduce_density(const Eigen::Ref<const DataMatrix> &grid,
+                        int block_size, DensityReduction *out);
+
+    //! Whether sampling calls into Python, i.e. the hierarchy is a
+    //! PythonHierarchy with some method not implemented natively
+    bool needs_gil() const;
     AlgorithmFactory &factory_algo = AlgorithmFactory::Instance();
     HierarchyFactory &factory_hier = HierarchyFactory::Instance();
     MixingFactory &factory_mixing = MixingFactory::Instance();
@@ -35,17 +114,157 @@ public:
                      const std::string &serialized_hier_prior,
                      const std::string &serialized_mix_prior);
 
-    void run(const Eigen::MatrixXd &data, int niter, int burnin,
-             int rng_seed = -1);
+    //! Runs the algorithm on `data`, one datum per row, storing one every
+    //! `thin` iterations after the burn-in. If `fields` is not empty, only
+    //! those fields of the states are stored (see
+    //! SerializedCollector::set_field_mask); eval_density needs the full
+    //! states.
+    void run(const Eigen::Ref<const DataMatrix> &data, int niter, int burnin,
+             int rng_seed = -1, unsigned int thin = 1,
+             const std::vector <std::string> &fields = {});
 
-    Eigen::MatrixXd eval_density(const Eigen::MatrixXd grid) {
-        Eigen::MatrixXd out = algo->eval_lpdf(&collector, grid).array().exp();
+    //! Runs the algorithm as run() does, but starting from `initial_state`, a
+    //! serialized AlgorithmState with one allocation per row of `data`,
+    //! instead of the default initialization of the algorithm
+    void run_from_state(const Eigen::Ref<const DataMatrix> &data,
+                        const std::string &initial_state, int niter, int burnin, int rng_seed = -1,
+                        unsigned int thin = 1,
+                        const std::vector <std::string> &fields = {});
+
+    //! Starts a run as run() does in a background thread and returns its
+    //! handle at once. The data are copied into the algorithm before
+    //! returning. The run stops early when cancelled or when `rule` is met,
+    //! in which case its chain has fewer states; either way it can then be
+    //! resumed. Hierarchies calling into Python take the GIL for every
+    //! iteration. Until the run ends, every other method of the wrapper but
+    //! get_diagnostics throws, and so do the methods reading the chain of
+    //! collectors obtained before (see SerializedCollector::set_busy).
+    std::shared_ptr<RunHandle> run_async(const Eigen::Ref<const DataMatrix> &data,
+                                         int niter, int burnin, int rng_seed = -1,
+                                         unsigned int thin = 1,
+                                         const std::vector<std::string> &fields = {},
+                                         const RunHandle::StopRule &rule = {});
+
+    //! Returns the state of the current run, to be continued by resume()
+    //! after load_checkpoint(), possibly in another process; see Checkpoint
+    std::string checkpoint() const;
+
+    //! Sets up the algorithm to continue the run saved by checkpoint() on
+    //! `data`, which must be the data of that run. The wrapper must have been
+    //! created with the same algorithm, hierarchy, mixing and priors. The
+    //! states stored in a file (see set_output_file) are kept, those stored
+    //! in memory by another wrapper are not.
+    void load_checkpoint(const Eigen::Ref<const DataMatrix> &data,
+                         const std::string &checkpoint);
+
+    //! Runs `n_iter` more iterations from the end of the last run(), resume()
+    //! or load_checkpoint(), without burn-in, collecting them in the same
+    //! collector
+    void resume(unsigned int n_iter);
+
+    //! Density of every stored state on the grid, one row per state. The
+    //! grid is a view like the data; bayesmix evaluates a column-major copy.
+    Eigen::MatrixXd eval_density(const Eigen::Ref<const DataMatrix> &grid) {
+        check_idle();
+        algo_in_sync = false;
+        Eigen::MatrixXd out =
+                algo->eval_lpdf(&collector, Eigen::MatrixXd(grid)).array().exp();
         return out;
     }
 
+    //! Pointwise posterior mean and quantiles of the density on the grid,
+    //! reduced while replaying the chain so that the (n_iter, n_grid) matrix
+    //! of eval_density is never allocated. The grid is evaluated in blocks of
+    //! `block_size` points, which bound the memory of every evaluation.
+    DensityReduction eval_density_summary(const Eigen::Ref<const DataMatrix> &grid,
+                                          const std::vector<double> &probs,
+                                          int block_size = 256);
+
+    //! Reduces the density on `grid` after every saved iteration of the next
+    //! runs, see get_online_density. An empty grid disables it.
+    void set_online_density(const Eigen::Ref<const DataMatrix> &grid,
+                            const std::vector<double> &probs) {
+        check_idle();
+        online_grid = grid;
+        online_probs = probs;
+    }
+
+    const DensityReduction &get_online_density() const {
+        check_idle();
+        return online_density;
+    }
+
+    //! If false, the next runs do not store the chain
+    void set_store_chain(bool store) {
+        check_idle();
+        collector.set_store_states(store);
+    }
+
+    //! Streams the chain of the next runs to `path` (see StreamingFileCollector)
+    void set_output_file(const std::string &path) {
+        check_idle();
+        collector.set_file_sink(std::make_shared<StreamingFileCollector>(path));
+    }
+
+    //! Keeps the chain of the next runs in memory in a CompressedChain with a
+    //! keyframe every `keyframe_interval` states, 0 disables compression
+    void set_compression(unsigned int keyframe_interval) {
+        check_idle();
+        collector.set_compression(keyframe_interval);
+    }
+
+    //! If true, the next runs record the cluster allocations of every saved
+    //! iteration in a dense matrix, see SerializedCollector::get_allocations
+    void set_record_allocations(bool record) {
+        check_idle();
+        record_allocs = record;
+    }
+
+    //! If true, the next runs maintain diagnostics of the number of clusters,
+    //! of the log-likelihood and of the mixing parameters of the stored
+    //! states, see SerializedCollector::set_diagnostics
+    void set_diagnostics(bool enable) {
+        check_idle();
+        diagnostics = enable;
+    }
+
+    //! Diagnostics of the current or last run, null if not enabled. Safe to
+    //! query while a run is in progress.
+    std::shared_ptr<OnlineDiagnostics> get_diagnostics() const {
+        return collector.get_diagnostics();
+    }
+
+    //! If true, the next runs time their phases and count the calls to
+    //! Python, see Profiler
+    void set_profiling(bool enable) {
+        check_idle();
+        profiling = enable;
+    }
+
+    //! Writes the Chrome trace events of the next run to `path`, which also
+    //! turns on profiling; the trace covers that run only
+    void set_trace_file(const std::string &path) {
+        check_idle();
+        trace_file = path;
+        if (!path.empty()) profiling = true;
+    }
+
+    //! Call counts and total seconds of the phases of the last profiled run,
+    //! as a dict {phase: {"count": int, "seconds": float}}; phases which
+    //! never ran are left out
+    pybind11::dict get_profile() const;
+
     void say_hello();
 
-    const SerializedCollector &get_collector() const { return collector; }
+    const SerializedCollector &get_collector() const {
+        check_idle();
+        return collector;
+    }
+
+    std::shared_ptr <StreamingFileCollector> get_file_collector() const {
+        check_idle();
+        return collector.get_file_sink();
+    }
 
     void load_py_hier_implementation(const std::string &module_name);
 };
@@ -0,0 +1,316 @@
+#include <pybind11/embed.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "algorithm_wrapper.hpp"
+#include "diagnostics.hpp"
+#include "hierarchy_prior.pb.h"
+#include "mixing_prior.pb.h"
+
+/*
+Sampler throughput benchmarks
+
+Runs AlgorithmWrapper::run on synthetic univariate data for every combination
+of algorithm, hierarchy, mixing and number of data, and writes one JSON record
+per run. Hierarchies are either "NNIG" or the name of a Python module in the
+examples directory, run as a PythonHier. Marginal algorithms are paired with
+the DP and PY mixings, BlockedGibbs with TruncSB.
+
+Usage:
+  pybmix_bench [--niter N] [--burnin N] [--sizes 100,1000] [--seed N]
+               [--algorithms Neal2,...] [--hierarchies NNIG,...]
+               [--mixings DP,...] [--examples-dir DIR] [--output FILE]
+*/
+
+namespace py = pybind11;
+
+namespace {
+struct Options {
+    int niter = 1000;
+    int burnin = 100;
+    int seed = 20201124;
+    std::vector<int> sizes = {100, 1000, 10000};
+    std::vector<std::string> algorithms = {"Neal2", "Neal3", "Neal8",
+                                           "SplitMerge", "BlockedGibbs"};
+    std::vector<std::string> hierarchies = {"NNIG", "NNIG_Hierarchy_NGG",
+                                            "NNIG_Hierarchy_fixed_values",
+                                            "LapNIG_Hierarchy"};
+    std::vector<std::string> mixings = {"DP", "PY", "TruncSB"};
+    std::string examples_dir = PYBMIX_EXAMPLES_DIR;
+    std::string output = "pybmix_bench.json";
+};
+
+struct Result {
+    std::string algorithm, hierarchy, mixing, error;
+    int n = 0;
+    //! Whole run, and iterations after the burn-in only
+    double seconds = 0;
+    double sampling_seconds = 0;
+    long peak_rss_kb = -1;
+    double ess_n_clusters = 0;
+    double mean_n_clusters = 0;
+};
+
+std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> out;
+    std::stringstream stream(s);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 == argc) throw std::invalid_argument("Missing value for " + arg);
+        std::string value = argv[++i];
+        if (arg == "--niter") {
+            opts.niter = std::stoi(value);
+        } else if (arg == "--burnin") {
+            opts.burnin = std::stoi(value);
+        } else if (arg == "--seed") {
+            opts.seed = std::stoi(value);
+        } else if (arg == "--sizes") {
+            opts.sizes.clear();
+            for (auto &n: split(value)) opts.sizes.push_back(std::stoi(n));
+        } else if (arg == "--algorithms") {
+            opts.algorithms = split(value);
+        } else if (arg == "--hierarchies") {
+            opts.hierarchies = split(value);
+        } else if (arg == "--mixings") {
+            opts.mixings = split(value);
+        } else if (arg == "--examples-dir") {
+            opts.examples_dir = value;
+        } else if (arg == "--output") {
+            opts.output = value;
+        } else {
+            throw std::invalid_argument("Unknown option " + arg);
+        }
+    }
+    if (opts.burnin < 0 || opts.burnin >= opts.niter) {
+        throw std::invalid_argument("--burnin must be in [0, niter)");
+    }
+    return opts;
+}
+
+//! Three well separated normal components with weights 0.5, 0.3, 0.2
+Eigen::MatrixXd synthetic_data(int n, int seed) {
+    std::mt19937 rng(seed);
+    std::discrete_distribution<int> component({0.5, 0.3, 0.2});
+    const double means[3] = {-3.0, 0.0, 4.0};
+    const double sds[3] = {1.0, 0.5, 1.5};
+    Eigen::MatrixXd data(n, 1);
+    for (int i = 0; i < n; i++) {
+        int c = component(rng);
+        data(i, 0) = std::normal_distribution<double>(means[c], sds[c])(rng);
+    }
+    return data;
+}
+
+std::string hierarchy_prior(const std::string &hier, const Eigen::MatrixXd &data) {
+    if (hier != "NNIG") return bayesmix::PythonHierPrior().SerializeAsString();
+    // Same defaults as UnivariateNormal.make_default_fixed_params
+    double mean = data.mean();
+    double var = (data.array() - mean).square().mean();
+    bayesmix::NNIGPrior prior;
+    prior.mutable_fixed_values()->set_mean(mean);
+    prior.mutable_fixed_values()->set_var_scaling(0.01);
+    prior.mutable_fixed_values()->set_shape(3);
+    prior.mutable_fixed_values()->set_scale(var / 5);
+    return prior.SerializeAsString();
+}
+
+std::string mixing_prior(const std::string &mixing) {
+    if (mixing == "DP") {
+        bayesmix::DPPrior prior;
+        prior.mutable_fixed_value()->set_totalmass(1.0);
+        return prior.SerializeAsString();
+    } else if (mixing == "PY") {
+        bayesmix::PYPrior prior;
+        prior.mutable_fixed_values()->set_strength(1.0);
+        prior.mutable_fixed_values()->set_discount(0.1);
+        return prior.SerializeAsString();
+    } else if (mixing == "TruncSB") {
+        bayesmix::TruncSBPrior prior;
+        prior.set_num_components(20);
+        prior.mutable_dp_prior()->set_totalmass(1.0);
+        return prior.SerializeAsString();
+    }
+    throw std::invalid_argument("Unknown mixing " + mixing);
+}
+
+//! Whether the mixing can be used with the algorithm: TruncSB is only
+//! defined for conditional algorithms, DP and PY for marginal ones
+bool compatible(const std::string &algorithm, const std::string &mixing) {
+    return (algorithm == "BlockedGibbs") == (mixing == "TruncSB");
+}
+
+//! Resets the peak resident set size of the process, Linux only
+void reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (clear_refs) clear_refs << "5";
+}
+
+//! Peak resident set size in kB since the last reset_peak_rss, -1 if unknown
+long peak_rss_kb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return std::stol(line.substr(6));
+    }
+    return -1;
+}
+
+//! Number of distinct clusters in every recorded row of allocations
+std::vector<double> count_clusters(
+        const Eigen::Map<const SerializedCollector::AllocationMatrix> &allocs) {
+    std::vector<double> out(allocs.rows());
+    std::vector<char> seen;
+    for (int t = 0; t < allocs.rows(); t++) {
+        seen.assign(allocs.row(t).maxCoeff() + 1, 0);
+        int count = 0;
+        for (int i = 0; i < allocs.cols(); i++) {
+            if (!seen[allocs(t, i)]) {
+                seen[allocs(t, i)] = 1;
+                count++;
+            }
+        }
+        out[t] = count;
+    }
+    return out;
+}
+
+Result run_one(const Options &opts, const std::string &algorithm,
+               const std::string &hierarchy, const std::string &mixing,
+               const Eigen::MatrixXd &data) {
+    Result res{algorithm, hierarchy, mixing};
+    res.n = data.rows();
+    try {
+        bool python_hier = hierarchy != "NNIG";
+        AlgorithmWrapper wrapper(algorithm, python_hier ? "PythonHier" : "NNIG",
+                                 mixing, hierarchy_prior(hierarchy, data),
+                                 mixing_prior(mixing));
+        if (python_hier) wrapper.load_py_hier_implementation(hierarchy);
+        wrapper.set_record_allocations(true);
+        wrapper.set_store_chain(false);
+
+        // The burn-in runs first, so that the iterations the ESS is computed
+        // on are timed on their own; resume continues the same chain
+        reset_peak_rss();
+        auto start = std::chrono::steady_clock::now();
+        wrapper.run(data, opts.burnin, opts.burnin, opts.seed);
+        auto burnin_stop = std::chrono::steady_clock::now();
+        wrapper.resume(opts.niter - opts.burnin);
+        auto stop = std::chrono::steady_clock::now();
+        res.seconds = std::chrono::duration<double>(stop - start).count();
+        res.sampling_seconds = std::chrono::duration<double>(stop - burnin_stop).count();
+        res.peak_rss_kb = peak_rss_kb();
+
+        std::vector<double> n_clusters =
+                count_clusters(wrapper.get_collector().get_allocations());
+        res.ess_n_clusters = effective_sample_size(n_clusters);
+        for (double k: n_clusters) res.mean_n_clusters += k / n_clusters.size();
+    } catch (const std::exception &e) {
+        res.error = e.what();
+    }
+    return res;
+}
+
+//! JSON number, null if not finite
+std::string number(double x) {
+    if (!std::isfinite(x)) return "null";
+    std::ostringstream out;
+    out.precision(10);
+    out << x;
+    return out.str();
+}
+
+std::string quoted(const std::string &s) {
+    std::string out = "\"";
+    for (char c: s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+void write_json(std::ostream &out, const Options &opts,
+                const std::vector<Result> &results) {
+    out << "{\n  \"niter\": " << opts.niter << ",\n  \"burnin\": " << opts.burnin
+        << ",\n  \"seed\": " << opts.seed << ",\n  \"results\": [";
+    for (size_t r = 0; r < results.size(); r++) {
+        const Result &res = results[r];
+        out << (r ? "," : "") << "\n    {\"algorithm\": " << quoted(res.algorithm)
+            << ", \"hierarchy\": " << quoted(res.hierarchy)
+            << ", \"mixing\": " << quoted(res.mixing) << ", \"n\": " << res.n;
+        if (!res.error.empty()) {
+            out << ", \"error\": " << quoted(res.error) << "}";
+            continue;
+        }
+        // Every iteration moves each datum once; the per-move and ESS rates
+        // cover the iterations after the burn-in, which the ESS counts
+        double moves = static_cast<double>(opts.niter - opts.burnin) * res.n;
+        out << ", \"seconds\": " << number(res.seconds)
+            << ", \"sampling_seconds\": " << number(res.sampling_seconds)
+            << ", \"iterations_per_sec\": " << number(opts.niter / res.seconds)
+            << ", \"ns_per_datum_move\": " << number(1e9 * res.sampling_seconds / moves)
+            << ", \"peak_rss_kb\": " << res.peak_rss_kb
+            << ", \"mean_n_clusters\": " << number(res.mean_n_clusters)
+            << ", \"ess_n_clusters\": " << number(res.ess_n_clusters)
+            << ", \"ess_per_sec\": " << number(res.ess_n_clusters / res.sampling_seconds)
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+    Options opts;
+    try {
+        opts = parse_args(argc, argv);
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    py::scoped_interpreter guard{};
+    py::module_::import("sys").attr("path").attr("insert")(0, opts.examples_dir);
+
+    std::vector<Result> results;
+    for (int n: opts.sizes) {
+        Eigen::MatrixXd data = synthetic_data(n, opts.seed);
+        for (auto &algorithm: opts.algorithms) {
+            for (auto &hierarchy: opts.hierarchies) {
+                for (auto &mixing: opts.mixings) {
+                    if (!compatible(algorithm, mixing)) continue;
+                    std::cerr << algorithm << " " << hierarchy << " " << mixing
+                              << " n=" << n << std::endl;
+                    results.push_back(run_one(opts, algorithm, hierarchy, mixing, data));
+                }
+            }
+        }
+    }
+
+    std::ofstream out(opts.output);
+    write_json(out, opts, results);
+    std::cerr << "Results written to " << opts.output << std::endl;
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include "checkpoint.hpp"
+
+#include <pybind11/stl.h>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+const char MAGIC[] = "PYBMIXCK";
+const size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+void write_uint(uint64_t value, std::string *out) {
+    for (int b = 0; b < 8; b++) out->push_back(static_cast<char>(value >> (8 * b)));
+}
+
+void write_string(const std::string &value, std::string *out) {
+    write_uint(value.size(), out);
+    out->append(value);
+}
+
+//! Sequential reader of the fields of a checkpoint
+class Reader {
+public:
+    explicit Reader(const std::string &bytes) : bytes(bytes) {}
+
+    uint64_t read_uint() {
+        check(8);
+        uint64_t value = 0;
+        for (int b = 0; b < 8; b++) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(bytes[pos + b])) << (8 * b);
+        }
+        pos += 8;
+        return value;
+    }
+
+    std::string read_string() {
+        uint64_t size = read_uint();
+        check(size);
+        std::string out = bytes.substr(pos, size);
+        pos += size;
+        return out;
+    }
+
+    void check(uint64_t size) const {
+        if (size > bytes.size() - pos) {
+            throw std::invalid_argument("Truncated checkpoint");
+        }
+    }
+
+    size_t pos = 0;
+
+private:
+    const std::string &bytes;
+};
+}  // namespace
+
+std::string Checkpoint::serialize() const {
+    std::string out(MAGIC, MAGIC_SIZE);
+    write_uint(VERSION, &out);
+    write_string(algorithm, &out);
+    write_string(hierarchy, &out);
+    write_string(mixing, &out);
+    write_uint(n_iter, &out);
+    write_uint(n_seen, &out);
+    write_uint(n_stored, &out);
+    write_uint(thin, &out);
+    write_uint(fields.size(), &out);
+    for (auto &field: fields) write_string(field, &out);
+    write_string(state, &out);
+    write_string(rng, &out);
+    return out;
+}
+
+Checkpoint Checkpoint::parse(const std::string &bytes) {
+    if (bytes.compare(0, MAGIC_SIZE, MAGIC) != 0) {
+        throw std::invalid_argument("Not a pybmix checkpoint");
+    }
+    Reader reader(bytes);
+    reader.pos = MAGIC_SIZE;
+    uint64_t version = reader.read_uint();
+    if (version != VERSION) {
+        throw std::invalid_argument("Unsupported checkpoint version " +
+                                    std::to_string(version));
+    }
+    Checkpoint out;
+    out.algorithm = reader.read_string();
+    out.hierarchy = reader.read_string();
+    out.mixing = reader.read_string();
+    out.n_iter = reader.read_uint();
+    out.n_seen = reader.read_uint();
+    out.n_stored = reader.read_uint();
+    out.thin = reader.read_uint();
+    uint64_t n_fields = reader.read_uint();
+    for (uint64_t f = 0; f < n_fields; f++) out.fields.push_back(reader.read_string());
+    out.state = reader.read_string();
+    out.rng = reader.read_string();
+    return out;
+}
+
+void add_checkpoint(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<Checkpoint>(m, "Checkpoint")
+            .def_static("from_bytes", [](const py::bytes &bytes) {
+                return Checkpoint::parse(bytes);
+            })
+            .def("to_bytes", [](const Checkpoint &self) {
+                return py::bytes(self.serialize());
+            })
+            .def_readonly("algorithm", &Checkpoint::algorithm)
+            .def_readonly("hierarchy", &Checkpoint::hierarchy)
+            .def_readonly("mixing", &Checkpoint::mixing)
+            .def_readonly("n_iter", &Checkpoint::n_iter)
+            .def_readonly("n_stored", &Checkpoint::n_stored)
+            .def_readonly("thin", &Checkpoint::thin)
+            .def_readonly("fields", &Checkpoint::fields)
+            .def_property_readonly("state", [](const Checkpoint &self) {
+                return py::bytes(self.state);
+            });
+}
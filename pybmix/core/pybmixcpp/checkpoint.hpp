@@ -0,0 +1,46 @@
+#ifndef PYBMIX_CHECKPOINT_
+#define PYBMIX_CHECKPOINT_
+
+#include <pybind11/pybind11.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Everything needed to continue a run of AlgorithmWrapper in another
+//! process: the last state of the algorithm (clusters, allocations, mixing
+//! state and hierarchy hyperparameters), the state of the bayesmix random
+//! engine and the position of the collector in the chain. Python hierarchies
+//! draw from the bayesmix engine, so its state covers them as well.
+//!
+//! Serialized as the magic "PYBMIXCK", the version and the fields below in
+//! order, integers (the version included) as little-endian uint64 and strings
+//! prefixed by their uint64 length.
+struct Checkpoint {
+    static const uint32_t VERSION = 1;
+
+    std::string algorithm;
+    std::string hierarchy;
+    std::string mixing;
+    //! Iterations run so far, burn-in included
+    uint64_t n_iter = 0;
+    //! States seen by the collector so far, before thinning
+    uint64_t n_seen = 0;
+    //! States stored by the collector so far
+    uint64_t n_stored = 0;
+    uint64_t thin = 1;
+    std::vector<std::string> fields;
+    //! Serialized bayesmix::AlgorithmState
+    std::string state;
+    //! std::mt19937 state as written by operator<<
+    std::string rng;
+
+    std::string serialize() const;
+
+    //! Throws std::invalid_argument if `bytes` is not a valid checkpoint
+    static Checkpoint parse(const std::string &bytes);
+};
+
+void add_checkpoint(pybind11::module &m);
+
+#endif
@@ -0,0 +1,113 @@
+#include "combinatorials.hpp"
+
+#include <pybind11/eigen.h>
+
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+//! Rows of D(n, k; sigma) computed so far, keyed by (sigma, n). A row holds
+//! the columns up to min(n, k_max).
+struct CachedRow {
+    unsigned int k_max;
+    Eigen::ArrayXd values;
+};
+
+//! Rows are small, but requests for many different n and sigma are possible
+const size_t MAX_CACHED_ROWS = 256;
+
+std::mutex cache_mutex;
+std::map<std::pair<double, unsigned int>, CachedRow> cache;
+
+//! Advances `row` from D(m - 1, .) to D(m, .), over the columns up to
+//! min(m, k_max)
+void next_row(unsigned int m, double sigma, unsigned int k_max,
+              Eigen::ArrayXd *row) {
+    const double neg_inf = -std::numeric_limits<double>::infinity();
+    const unsigned int last = std::min(m, k_max);
+    Eigen::ArrayXd &r = *row;
+    if (m <= k_max) {
+        r.conservativeResize(m + 1);
+        // D(m, m) = D(m - 1, m - 1) = 1
+        r(m) = 0.0;
+    }
+    // Both terms are finite for 1 <= k <= m - 1
+    const unsigned int inner = std::min(m - 1, last);
+    if (inner >= 1) {
+        Eigen::ArrayXd k = Eigen::ArrayXd::LinSpaced(inner, 1, inner);
+        Eigen::ArrayXd stay = (static_cast<double>(m - 1) - sigma * k).log() +
+                              r.segment(1, inner);
+        Eigen::ArrayXd join = r.segment(0, inner);
+        Eigen::ArrayXd hi = stay.max(join);
+        r.segment(1, inner) = hi + ((stay.min(join) - hi).exp()).log1p();
+    }
+    r(0) = neg_inf;
+}
+
+//! Returns the row of D(n, .) up to column min(n, k_max), extending the
+//! largest cached row with n' <= n which has the columns needed
+Eigen::ArrayXd cached_row(unsigned int n, double sigma, unsigned int k_max) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    const unsigned int cols = std::min(n, k_max);
+
+    unsigned int start = 0;
+    Eigen::ArrayXd row = Eigen::ArrayXd::Zero(1);
+    auto it = cache.upper_bound({sigma, n});
+    while (it != cache.begin()) {
+        --it;
+        if (it->first.first != sigma) break;
+        unsigned int cached_n = it->first.second;
+        if (it->second.k_max >= k_max || it->second.k_max >= cached_n) {
+            start = cached_n;
+            row = it->second.values.head(std::min(cached_n, k_max) + 1);
+            break;
+        }
+    }
+    if (start == n && row.size() == cols + 1) return row;
+
+    for (unsigned int m = start + 1; m <= n; m++) next_row(m, sigma, k_max, &row);
+
+    if (cache.size() >= MAX_CACHED_ROWS) cache.clear();
+    auto &entry = cache[{sigma, n}];
+    if (entry.values.size() <= cols) entry = CachedRow{k_max, row};
+    return row;
+}
+}  // namespace
+
+Eigen::VectorXd log_scaled_generalized_factorial(unsigned int n, double sigma,
+                                                 unsigned int k_max) {
+    if (!(sigma >= 0 && sigma < 1)) {
+        throw std::invalid_argument("'sigma' must be in [0, 1)");
+    }
+    return cached_row(n, sigma, k_max).matrix();
+}
+
+Eigen::VectorXd log_stirling_first(unsigned int n, unsigned int k_max) {
+    return log_scaled_generalized_factorial(n, 0.0, k_max);
+}
+
+Eigen::VectorXd log_generalized_factorial(unsigned int n, double sigma,
+                                          unsigned int k_max) {
+    Eigen::ArrayXd out = log_scaled_generalized_factorial(n, sigma, k_max).array();
+    Eigen::ArrayXd k = Eigen::ArrayXd::LinSpaced(out.size(), 0, out.size() - 1);
+    out += k * std::log(sigma);
+    // C(0, 0) = 1 also for sigma = 0
+    out(0) = n == 0 ? 0.0 : -std::numeric_limits<double>::infinity();
+    return out.matrix();
+}
+
+void add_combinatorials(pybind11::module &m) {
+    namespace py = pybind11;
+    const unsigned int all = std::numeric_limits<unsigned int>::max();
+
+    m.def("_log_stirling_first", &log_stirling_first, py::arg("n"),
+          py::arg("k_max") = all);
+    m.def("_log_generalized_factorial", &log_generalized_factorial, py::arg("n"),
+          py::arg("sigma"), py::arg("k_max") = all);
+    m.def("_log_scaled_generalized_factorial", &log_scaled_generalized_factorial,
+          py::arg("n"), py::arg("sigma"), py::arg("k_max") = all);
+}
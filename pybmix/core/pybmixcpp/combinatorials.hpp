@@ -0,0 +1,31 @@
+#ifndef PYBMIX_COMBINATORIALS_
+#define PYBMIX_COMBINATORIALS_
+
+#include <pybind11/pybind11.h>
+
+#include <Eigen/Dense>
+
+//! Logarithm of the generalized factorial coefficients C(n, k; sigma) for
+//! k = 0, ..., min(n, k_max), divided by sigma^k:
+//!     D(n, k) = (n - 1 - sigma * k) D(n - 1, k) + D(n - 1, k - 1),
+//! with D(0, 0) = 1, D(n, 0) = 0 for n > 0 and sigma in [0, 1). For
+//! sigma = 0 they are the unsigned Stirling numbers of the first kind.
+//!
+//! The recurrence is run in log space with log-sum-exp, so it does not
+//! overflow, in O(n * min(n, k_max)) operations. Rows are cached across
+//! calls, and a row is computed by extending the closest cached one.
+Eigen::VectorXd log_scaled_generalized_factorial(unsigned int n, double sigma,
+                                                 unsigned int k_max);
+
+//! log |s(n, k)|, unsigned Stirling numbers of the first kind, for
+//! k = 0, ..., min(n, k_max)
+Eigen::VectorXd log_stirling_first(unsigned int n, unsigned int k_max);
+
+//! log C(n, k; sigma), generalized factorial coefficients, for
+//! k = 0, ..., min(n, k_max)
+Eigen::VectorXd log_generalized_factorial(unsigned int n, double sigma,
+                                          unsigned int k_max);
+
+void add_combinatorials(pybind11::module &m);
+
+#endif
@@ -0,0 +1,441 @@
+#include "compressed_chain.hpp"
+
+#include <pybind11/eigen.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include "field_extractor.hpp"
+
+namespace {
+const char MAGIC[] = "PYBMIXCC";
+const size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+const uint8_t KEYFRAME = 0;
+const uint8_t DELTA = 1;
+
+//! Largest table of (previous, new) cluster pairs counted to relabel the
+//! previous clusters in a delta
+const uint64_t MAX_RELABEL_TABLE = 1 << 16;
+
+void write_varint(uint64_t value, std::string *out) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(static_cast<uint8_t>(value) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+int varint_size(uint64_t value) {
+    int n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+//! Reads a varint from `*pos`, which is at most `end`
+uint64_t read_varint(const uint8_t **pos, const uint8_t *end) {
+    uint64_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        if (*pos == end || shift > 63) {
+            throw std::invalid_argument("Corrupted compressed chain");
+        }
+        byte = *(*pos)++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+//! Reads a cluster label, which is a non-negative int32
+int32_t read_label(const uint8_t **pos, const uint8_t *end) {
+    uint64_t label = read_varint(pos, end);
+    if (label > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+        throw std::invalid_argument("Corrupted compressed chain");
+    }
+    return static_cast<int32_t>(label);
+}
+
+//! Integers in the files are little-endian on every host
+void write_uint(uint64_t value, std::FILE *file, const std::string &path) {
+    uint8_t bytes[8];
+    for (int b = 0; b < 8; b++) bytes[b] = static_cast<uint8_t>(value >> (8 * b));
+    if (std::fwrite(bytes, sizeof(bytes), 1, file) != 1) {
+        throw std::runtime_error("Could not write the chain to " + path);
+    }
+}
+
+uint64_t read_uint(std::FILE *file, const std::string &path) {
+    uint8_t bytes[8];
+    if (std::fread(bytes, sizeof(bytes), 1, file) != 1) {
+        throw std::invalid_argument("Truncated chain in " + path);
+    }
+    uint64_t value = 0;
+    for (int b = 0; b < 8; b++) value |= static_cast<uint64_t>(bytes[b]) << (8 * b);
+    return value;
+}
+
+struct FileCloser {
+    void operator()(std::FILE *f) const { std::fclose(f); }
+};
+}  // namespace
+
+CompressedChain::CompressedChain(unsigned int keyframe_interval)
+        : keyframe_interval(keyframe_interval) {
+    if (keyframe_interval == 0) {
+        throw std::invalid_argument("The keyframe interval must be positive");
+    }
+}
+
+void CompressedChain::clear() {
+    alloc_bytes.clear();
+    alloc_offsets.clear();
+    rest_bytes.clear();
+    rest_offsets.clear();
+    last_allocs.clear();
+    std::lock_guard<std::mutex> lock(read_cursor.mutex);
+    read_cursor.cursor = Cursor();
+}
+
+void CompressedChain::append(const bayesmix::AlgorithmState &state) {
+    rest.CopyFrom(state);
+    rest.clear_cluster_allocs();
+    rest_offsets.push_back(rest_bytes.size());
+    rest.AppendToString(&rest_bytes);
+
+    const auto &allocs = state.cluster_allocs();
+    alloc_offsets.push_back(alloc_bytes.size());
+    bool keyframe = (alloc_offsets.size() - 1) % keyframe_interval == 0 ||
+                    allocs.size() != static_cast<int>(last_allocs.size());
+    if (keyframe || !encode_delta(allocs)) encode_keyframe(allocs);
+    last_allocs.assign(allocs.begin(), allocs.end());
+}
+
+void CompressedChain::encode_keyframe(
+        const google::protobuf::RepeatedField<int32_t> &allocs) {
+    alloc_bytes.push_back(static_cast<char>(KEYFRAME));
+    write_varint(allocs.size(), &alloc_bytes);
+    for (int32_t label: allocs) write_varint(label, &alloc_bytes);
+}
+
+bool CompressedChain::encode_delta(
+        const google::protobuf::RepeatedField<int32_t> &allocs) {
+    const int n = allocs.size();
+    int32_t n_prev = 0, n_new = 0;
+    uint64_t keyframe_size = 1 + varint_size(n);
+    for (int i = 0; i < n; i++) {
+        n_prev = std::max(n_prev, last_allocs[i] + 1);
+        n_new = std::max(n_new, allocs[i] + 1);
+        keyframe_size += varint_size(allocs[i]);
+    }
+
+    // Sends every previous cluster to the new one most of its data are in
+    relabel.clear();
+    if (static_cast<uint64_t>(n_prev) * n_new <= MAX_RELABEL_TABLE) {
+        counts.assign(static_cast<size_t>(n_prev) * n_new, 0);
+        for (int i = 0; i < n; i++) counts[last_allocs[i] * n_new + allocs[i]]++;
+        bool identity = true;
+        relabel.resize(n_prev);
+        for (int32_t c = 0; c < n_prev; c++) {
+            const uint32_t *row = counts.data() + static_cast<size_t>(c) * n_new;
+            int32_t best = c < n_new ? c : 0;
+            for (int32_t d = 0; d < n_new; d++) {
+                if (row[d] > row[best]) best = d;
+            }
+            relabel[c] = best;
+            identity = identity && best == c;
+        }
+        if (identity) relabel.clear();
+    }
+
+    buffer.clear();
+    buffer.push_back(static_cast<char>(DELTA));
+    write_varint(relabel.size(), &buffer);
+    for (int32_t label: relabel) write_varint(label, &buffer);
+    std::string changes;
+    uint64_t n_changes = 0;
+    int64_t last_change = -1;
+    for (int i = 0; i < n; i++) {
+        int32_t prev = relabel.empty() ? last_allocs[i] : relabel[last_allocs[i]];
+        if (prev == allocs[i]) continue;
+        write_varint(i - last_change, &changes);
+        write_varint(allocs[i], &changes);
+        last_change = i;
+        n_changes++;
+        if (buffer.size() + changes.size() >= keyframe_size) return false;
+    }
+    write_varint(n_changes, &buffer);
+    if (buffer.size() + changes.size() >= keyframe_size) return false;
+    alloc_bytes.append(buffer);
+    alloc_bytes.append(changes);
+    return true;
+}
+
+uint64_t CompressedChain::get_nbytes() const {
+    return alloc_bytes.size() + rest_bytes.size() +
+           sizeof(uint64_t) * (alloc_offsets.size() + rest_offsets.size());
+}
+
+unsigned int CompressedChain::keyframe_of(unsigned int i) const {
+    while (static_cast<uint8_t>(alloc_bytes[alloc_offsets[i]]) != KEYFRAME) {
+        if (i == 0) throw std::invalid_argument("Corrupted compressed chain");
+        i--;
+    }
+    return i;
+}
+
+void CompressedChain::decode_frame(unsigned int i,
+                                   std::vector<int32_t> *allocs) const {
+    const uint8_t *begin = reinterpret_cast<const uint8_t *>(alloc_bytes.data());
+    const uint8_t *pos = begin + alloc_offsets[i];
+    const uint8_t *end = begin + (i + 1 < alloc_offsets.size() ? alloc_offsets[i + 1]
+                                                               : alloc_bytes.size());
+    // Every varint takes at least one byte, which bounds the counts
+    const uint8_t type = *pos++;
+    if (type == KEYFRAME) {
+        uint64_t n = read_varint(&pos, end);
+        if (n > static_cast<uint64_t>(end - pos)) {
+            throw std::invalid_argument("Corrupted compressed chain");
+        }
+        allocs->resize(n);
+        for (auto &label: *allocs) label = read_label(&pos, end);
+        if (pos != end) throw std::invalid_argument("Corrupted compressed chain");
+        return;
+    }
+    if (type != DELTA) throw std::invalid_argument("Corrupted compressed chain");
+
+    uint64_t n_relabel = read_varint(&pos, end);
+    if (n_relabel > static_cast<uint64_t>(end - pos)) {
+        throw std::invalid_argument("Corrupted compressed chain");
+    }
+    if (n_relabel > 0) {
+        std::vector<int32_t> labels(n_relabel);
+        for (auto &label: labels) label = read_label(&pos, end);
+        for (auto &label: *allocs) {
+            if (static_cast<uint64_t>(label) >= n_relabel) {
+                throw std::invalid_argument("Corrupted compressed chain");
+            }
+            label = labels[label];
+        }
+    }
+    uint64_t n_changes = read_varint(&pos, end);
+    uint64_t datum = -1;
+    for (uint64_t c = 0; c < n_changes; c++) {
+        uint64_t gap = read_varint(&pos, end);
+        if (gap == 0 || gap > allocs->size() - (datum + 1)) {
+            throw std::invalid_argument("Corrupted compressed chain");
+        }
+        datum += gap;
+        (*allocs)[datum] = read_label(&pos, end);
+    }
+    if (pos != end) throw std::invalid_argument("Corrupted compressed chain");
+}
+
+void CompressedChain::seek(unsigned int i, Cursor *cursor) const {
+    if (i >= get_size()) {
+        throw std::out_of_range("State " + std::to_string(i) + " out of range");
+    }
+    if (cursor->index == i) return;
+    int64_t keyframe = keyframe_of(i);
+    int64_t start = (cursor->index >= keyframe && cursor->index < i)
+                    ? cursor->index + 1 : keyframe;
+    for (int64_t j = start; j <= i; j++) decode_frame(j, &cursor->allocs);
+    cursor->index = i;
+}
+
+void CompressedChain::parse_rest(unsigned int i,
+                                 google::protobuf::Message *out) const {
+    uint64_t end = i + 1 < rest_offsets.size() ? rest_offsets[i + 1]
+                                               : rest_bytes.size();
+    if (!out->ParseFromArray(rest_bytes.data() + rest_offsets[i],
+                             end - rest_offsets[i])) {
+        throw std::invalid_argument("Corrupted state " + std::to_string(i) +
+                                    " in the compressed chain");
+    }
+}
+
+void CompressedChain::get_state(unsigned int i, bayesmix::AlgorithmState *out,
+                                Cursor *cursor) const {
+    seek(i, cursor);
+    parse_rest(i, out);
+    google::protobuf::RepeatedField<int32_t>(cursor->allocs.begin(),
+                                             cursor->allocs.end())
+            .Swap(out->mutable_cluster_allocs());
+}
+
+std::string CompressedChain::get_state_string(unsigned int i) const {
+    bayesmix::AlgorithmState state;
+    std::lock_guard<std::mutex> lock(read_cursor.mutex);
+    get_state(i, &state, &read_cursor.cursor);
+    return state.SerializeAsString();
+}
+
+template <typename T>
+void CompressedChain::decode_allocations(Cursor *cursor, T *out) const {
+    const size_t n_data = cursor->allocs.size();
+    for (unsigned int i = 0; i < get_size(); i++) {
+        seek(i, cursor);
+        if (cursor->allocs.size() != n_data) {
+            throw std::invalid_argument(
+                    "The number of allocations changes along the chain");
+        }
+        std::copy(cursor->allocs.begin(), cursor->allocs.end(), out + i * n_data);
+    }
+}
+
+CompressedChain::AllocationMatrix CompressedChain::get_allocations() const {
+    if (get_size() == 0) return AllocationMatrix(0, 0);
+    Cursor cursor;
+    seek(0, &cursor);
+    AllocationMatrix out(get_size(), cursor.allocs.size());
+    decode_allocations(&cursor, out.data());
+    return out;
+}
+
+pybind11::array CompressedChain::extract_field(const std::string &path) const {
+    namespace py = pybind11;
+    if (path == "cluster_allocs" && get_size() > 0) {
+        Cursor cursor;
+        seek(0, &cursor);
+        py::array_t<int64_t> out(
+                {static_cast<py::ssize_t>(get_size()),
+                 static_cast<py::ssize_t>(cursor.allocs.size())});
+        decode_allocations(&cursor, out.mutable_data());
+        return out;
+    }
+
+    FieldExtractor extractor(bayesmix::AlgorithmState::default_instance(), path);
+    if (path.compare(0, 14, "cluster_allocs") == 0) {
+        return extractor.extract(
+                get_size(), [this](unsigned int i, google::protobuf::Message *out) {
+                    Cursor cursor;
+                    get_state(i, static_cast<bayesmix::AlgorithmState *>(out), &cursor);
+                });
+    }
+    // The other fields do not need the allocations
+    return extractor.extract(
+            get_size(), [this](unsigned int i, google::protobuf::Message *out) {
+                parse_rest(i, out);
+            });
+}
+
+void CompressedChain::save(const std::string &path) const {
+    std::unique_ptr<std::FILE, FileCloser> file(std::fopen(path.c_str(), "wb"));
+    if (!file) throw std::runtime_error("Could not open file " + path);
+    std::FILE *f = file.get();
+    if (std::fwrite(MAGIC, 1, MAGIC_SIZE, f) != MAGIC_SIZE) {
+        throw std::runtime_error("Could not write the chain to " + path);
+    }
+    write_uint(VERSION, f, path);
+    write_uint(keyframe_interval, f, path);
+    write_uint(get_size(), f, path);
+    for (const auto *offsets: {&alloc_offsets, &rest_offsets}) {
+        for (uint64_t offset: *offsets) write_uint(offset, f, path);
+    }
+    for (const auto *bytes: {&alloc_bytes, &rest_bytes}) {
+        write_uint(bytes->size(), f, path);
+        if (std::fwrite(bytes->data(), 1, bytes->size(), f) != bytes->size()) {
+            throw std::runtime_error("Could not write the chain to " + path);
+        }
+    }
+}
+
+CompressedChain CompressedChain::load(const std::string &path) {
+    std::unique_ptr<std::FILE, FileCloser> file(std::fopen(path.c_str(), "rb"));
+    if (!file) throw std::runtime_error("Could not open file " + path);
+    std::FILE *f = file.get();
+    char magic[MAGIC_SIZE];
+    if (std::fread(magic, 1, MAGIC_SIZE, f) != MAGIC_SIZE ||
+        std::memcmp(magic, MAGIC, MAGIC_SIZE) != 0) {
+        throw std::invalid_argument(path + " is not a pybmix compressed chain");
+    }
+    uint64_t version = read_uint(f, path);
+    if (version != VERSION) {
+        throw std::invalid_argument("Unsupported compressed chain version " +
+                                    std::to_string(version));
+    }
+    uint64_t keyframe_interval = read_uint(f, path);
+    if (keyframe_interval == 0 ||
+        keyframe_interval > std::numeric_limits<unsigned int>::max()) {
+        throw std::invalid_argument("Invalid keyframe interval in " + path);
+    }
+    CompressedChain out(keyframe_interval);
+
+    // Sizes are checked against the rest of the file before allocating
+    long start = std::ftell(f);
+    std::fseek(f, 0, SEEK_END);
+    uint64_t remaining = std::ftell(f) - start;
+    std::fseek(f, start, SEEK_SET);
+    uint64_t n_states = read_uint(f, path);
+    if (n_states > std::numeric_limits<unsigned int>::max() ||
+        n_states > remaining / (2 * sizeof(uint64_t))) {
+        throw std::invalid_argument("Truncated chain in " + path);
+    }
+    remaining -= sizeof(uint64_t) * (1 + 2 * n_states);
+    for (auto *offsets: {&out.alloc_offsets, &out.rest_offsets}) {
+        offsets->resize(n_states);
+        for (auto &offset: *offsets) offset = read_uint(f, path);
+    }
+    for (auto *bytes: {&out.alloc_bytes, &out.rest_bytes}) {
+        uint64_t size = read_uint(f, path);
+        if (remaining < sizeof(uint64_t) || size > remaining - sizeof(uint64_t)) {
+            throw std::invalid_argument("Truncated chain in " + path);
+        }
+        remaining -= sizeof(uint64_t) + size;
+        bytes->resize(size);
+        if (std::fread(&(*bytes)[0], 1, bytes->size(), f) != bytes->size()) {
+            throw std::invalid_argument("Truncated chain in " + path);
+        }
+    }
+
+    // Allocation frames take at least one byte, the other fields may be empty
+    for (uint64_t i = 0; i < n_states; i++) {
+        if (out.alloc_offsets[i] >= out.alloc_bytes.size() ||
+            (i > 0 && out.alloc_offsets[i] <= out.alloc_offsets[i - 1]) ||
+            out.rest_offsets[i] > out.rest_bytes.size() ||
+            (i > 0 && out.rest_offsets[i] < out.rest_offsets[i - 1])) {
+            throw std::invalid_argument("Corrupted index in " + path);
+        }
+    }
+
+    // Decoding every frame once validates the allocations; new states are
+    // encoded against the last one
+    Cursor cursor;
+    for (uint64_t i = 0; i < n_states; i++) out.seek(i, &cursor);
+    out.last_allocs = cursor.allocs;
+    return out;
+}
+
+void add_compressed_chain(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<CompressedChain, std::shared_ptr<CompressedChain>>(m, "CompressedChain")
+            .def(py::init<unsigned int>(), py::arg("keyframe_interval") = 64)
+            .def_static("load", [](const std::string &path) {
+                return std::make_shared<CompressedChain>(CompressedChain::load(path));
+            })
+            .def("save", &CompressedChain::save)
+            .def("get_size", &CompressedChain::get_size)
+            .def("get_nbytes", &CompressedChain::get_nbytes)
+            .def("get_keyframe_interval", &CompressedChain::get_keyframe_interval)
+            .def("get_serialized_state", &CompressedChain::get_serialized_state)
+            .def("get_allocations", &CompressedChain::get_allocations)
+            .def("extract_field", &CompressedChain::extract_field)
+            // Sequence of serialized states, so that MCMCchain can read it
+            .def("__len__", &CompressedChain::get_size)
+            .def("__getitem__", [](const CompressedChain &self, int64_t i) {
+                if (i < 0) i += self.get_size();
+                if (i < 0 || i >= self.get_size()) {
+                    throw py::index_error("state index out of range");
+                }
+                return self.get_serialized_state(i);
+            });
+}
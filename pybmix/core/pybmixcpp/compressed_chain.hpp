@@ -0,0 +1,148 @@
+#ifndef PYBMIX_COMPRESSED_CHAIN_
+#define PYBMIX_COMPRESSED_CHAIN_
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "algorithm_state.pb.h"
+
+//! Compact in-memory storage of a chain of AlgorithmState, which can be
+//! saved to and loaded from disk.
+//!
+//! Consecutive states differ in a few allocations, so `cluster_allocs` are
+//! stored apart from the rest of the state as frames of varints. Every
+//! `keyframe_interval` states, and whenever the number of data changes, a
+//! keyframe stores the allocations in full. The other states store a delta
+//! against the previous one: an optional relabeling of the previous
+//! clusters, which absorbs the shift of the labels when a cluster is
+//! removed, followed by the data whose cluster differs from the relabeled
+//! one, as (gap from the previous such datum, label) pairs. The rest of the
+//! state, without allocations, is kept as a serialized message.
+//!
+//! Any state is decoded from its keyframe, the whole allocation matrix in a
+//! single sequential pass. Fields which do not involve the allocations are
+//! read from the rest of the states only.
+class CompressedChain {
+public:
+    using AllocationMatrix = Eigen::Matrix<int32_t, Eigen::Dynamic,
+            Eigen::Dynamic, Eigen::RowMajor>;
+
+    //! Decoding position, so that reading consecutive states decodes each
+    //! delta once
+    struct Cursor {
+        int64_t index = -1;
+        std::vector<int32_t> allocs;
+    };
+
+    explicit CompressedChain(unsigned int keyframe_interval = 64);
+
+    void clear();
+
+    void append(const bayesmix::AlgorithmState &state);
+
+    unsigned int get_size() const { return alloc_offsets.size(); }
+
+    unsigned int get_keyframe_interval() const { return keyframe_interval; }
+
+    //! Bytes used by the encoded states and their index
+    uint64_t get_nbytes() const;
+
+    //! Writes the i-th state in `out`, moving `cursor` to it
+    void get_state(unsigned int i, bayesmix::AlgorithmState *out,
+                   Cursor *cursor) const;
+
+    //! Returns the i-th state, serialized. Consecutive calls share a cursor,
+    //! so that reading the chain in order decodes each delta once.
+    std::string get_state_string(unsigned int i) const;
+
+    pybind11::bytes get_serialized_state(unsigned int i) const {
+        return (pybind11::bytes) get_state_string(i);
+    }
+
+    //! Returns the (n_states, n_data) matrix of the allocations; throws
+    //! std::invalid_argument if the number of data changes along the chain
+    AllocationMatrix get_allocations() const;
+
+    //! Returns the chain of one field as a numpy array, see FieldExtractor.
+    //! "cluster_allocs" is decoded directly into the array.
+    pybind11::array extract_field(const std::string &path) const;
+
+    //! Writes the chain to `path`: the magic "PYBMIXCC", a version, the
+    //! keyframe interval and the number of states, then the offsets of the
+    //! allocation frames and of the other fields of each state and the two
+    //! encoded buffers, each preceded by its size; integers are
+    //! little-endian uint64 on every host
+    void save(const std::string &path) const;
+
+    //! Reads a chain written by save(); throws std::invalid_argument if the
+    //! file is truncated or its index or allocations are corrupted
+    static CompressedChain load(const std::string &path);
+
+protected:
+    static const uint64_t VERSION = 1;
+
+    //! Moves `cursor` to the i-th state, from its current position if it is
+    //! behind i after the last keyframe, from the keyframe otherwise
+    void seek(unsigned int i, Cursor *cursor) const;
+
+    //! Decodes the allocation frame of the i-th state over the allocations
+    //! of the previous one; throws std::invalid_argument if it is corrupted
+    void decode_frame(unsigned int i, std::vector<int32_t> *allocs) const;
+
+    //! Parses the i-th state without its allocations in `out`
+    void parse_rest(unsigned int i, google::protobuf::Message *out) const;
+
+    //! Writes the allocations of every state in the rows of the row-major
+    //! (n_states, n_data) matrix at `out`, from `cursor` at the first state
+    template <typename T>
+    void decode_allocations(Cursor *cursor, T *out) const;
+
+    void encode_keyframe(const google::protobuf::RepeatedField<int32_t> &allocs);
+
+    //! Returns false, writing nothing, if a keyframe is not larger
+    bool encode_delta(const google::protobuf::RepeatedField<int32_t> &allocs);
+
+    //! Index of the last keyframe at or before the i-th state
+    unsigned int keyframe_of(unsigned int i) const;
+
+    unsigned int keyframe_interval;
+
+    std::string alloc_bytes;
+    std::vector<uint64_t> alloc_offsets;
+    std::string rest_bytes;
+    std::vector<uint64_t> rest_offsets;
+
+    //! Allocations of the last appended state, which the next delta refers to
+    std::vector<int32_t> last_allocs;
+
+    //! Cursor of get_state_string, guarded by its mutex. Copied and assigned
+    //! chains start from a fresh cursor.
+    struct SharedCursor {
+        Cursor cursor;
+        std::mutex mutex;
+
+        SharedCursor() = default;
+        SharedCursor(const SharedCursor &) {}
+        SharedCursor &operator=(const SharedCursor &) {
+            cursor = Cursor();
+            return *this;
+        }
+    };
+    mutable SharedCursor read_cursor;
+
+    //! Reused buffers of the encoder
+    bayesmix::AlgorithmState rest;
+    std::string buffer;
+    std::vector<uint32_t> counts;
+    std::vector<int32_t> relabel;
+};
+
+void add_compressed_chain(pybind11::module &m);
+
+#endif
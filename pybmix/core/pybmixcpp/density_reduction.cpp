@@ -0,0 +1,142 @@
+#include "density_reduction.hpp"
+
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+P2Quantile::P2Quantile(double prob) : prob(prob) {
+    if (prob < 0 || prob > 1) {
+        throw std::invalid_argument("Quantile probabilities must be in [0, 1]");
+    }
+}
+
+void P2Quantile::add(double x) {
+    if (count < 5) {
+        heights[count++] = x;
+        if (count == 5) {
+            std::sort(heights, heights + 5);
+            for (int i = 0; i < 5; i++) positions[i] = i + 1;
+            double init_desired[5] = {1, 1 + 2 * prob, 1 + 4 * prob, 3 + 2 * prob, 5};
+            double init_increments[5] = {0, prob / 2, prob, (1 + prob) / 2, 1};
+            std::copy(init_desired, init_desired + 5, desired);
+            std::copy(init_increments, init_increments + 5, increments);
+        }
+        return;
+    }
+    count++;
+
+    // Cell of x, extending the extreme markers if needed
+    int k;
+    if (x < heights[0]) {
+        heights[0] = x;
+        k = 0;
+    } else if (x >= heights[4]) {
+        heights[4] = x;
+        k = 3;
+    } else {
+        k = 0;
+        while (x >= heights[k + 1]) k++;
+    }
+    for (int i = k + 1; i < 5; i++) positions[i]++;
+    for (int i = 0; i < 5; i++) desired[i] += increments[i];
+
+    // Move the middle markers towards their desired positions
+    for (int i = 1; i < 4; i++) {
+        double d = desired[i] - positions[i];
+        if ((d >= 1 && positions[i + 1] - positions[i] > 1) ||
+            (d <= -1 && positions[i - 1] - positions[i] < -1)) {
+            int step = d > 0 ? 1 : -1;
+            double candidate = parabolic(i, step);
+            if (heights[i - 1] < candidate && candidate < heights[i + 1]) {
+                heights[i] = candidate;
+            } else {
+                heights[i] += step * (heights[i + step] - heights[i]) /
+                              (positions[i + step] - positions[i]);
+            }
+            positions[i] += step;
+        }
+    }
+}
+
+double P2Quantile::parabolic(int i, int d) const {
+    const double *q = heights, *n = positions;
+    return q[i] + d / (n[i + 1] - n[i - 1]) *
+                  ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+                   (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+double P2Quantile::get() const {
+    if (count == 0) return std::numeric_limits<double>::quiet_NaN();
+    if (count >= 5) return heights[2];
+
+    // Few observations: exact quantile with linear interpolation
+    double sorted[5];
+    std::copy(heights, heights + count, sorted);
+    std::sort(sorted, sorted + count);
+    double pos = prob * (count - 1);
+    int lo = static_cast<int>(std::floor(pos));
+    int hi = std::min(lo + 1, count - 1);
+    return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+DensityReduction::DensityReduction(int n_grid, const std::vector<double> &probs)
+        : probs(probs),
+          log_max(Eigen::VectorXd::Constant(n_grid, -std::numeric_limits<double>::infinity())),
+          scaled_sum(Eigen::VectorXd::Zero(n_grid)) {
+    quantiles.reserve(n_grid * probs.size());
+    for (int g = 0; g < n_grid; g++) {
+        for (double p: probs) quantiles.emplace_back(p);
+    }
+}
+
+void DensityReduction::add(int start, const Eigen::Ref<const Eigen::VectorXd> &lpdf) {
+    const int n_probs = probs.size();
+    for (int i = 0; i < lpdf.size(); i++) {
+        const int g = start + i;
+        const double x = lpdf(i);
+        if (x > log_max(g)) {
+            scaled_sum(g) = scaled_sum(g) * std::exp(log_max(g) - x) + 1.0;
+            log_max(g) = x;
+        } else if (x > -std::numeric_limits<double>::infinity()) {
+            // A zero density adds nothing, while exp(x - log_max) would be
+            // NaN as long as log_max is -inf
+            scaled_sum(g) += std::exp(x - log_max(g));
+        }
+        for (int q = 0; q < n_probs; q++) quantiles[g * n_probs + q].add(x);
+    }
+}
+
+Eigen::VectorXd DensityReduction::log_mean() const {
+    if (n_iter == 0) {
+        return Eigen::VectorXd::Constant(get_n_grid(),
+                                         std::numeric_limits<double>::quiet_NaN());
+    }
+    // Points with zero density on every iteration have log_max = -inf and
+    // scaled_sum = 0, hence a log mean of -inf
+    return log_max.array() + scaled_sum.array().log() - std::log(n_iter);
+}
+
+Eigen::MatrixXd DensityReduction::log_quantiles() const {
+    const int n_probs = probs.size();
+    Eigen::MatrixXd out(n_probs, get_n_grid());
+    for (int g = 0; g < get_n_grid(); g++) {
+        for (int q = 0; q < n_probs; q++) out(q, g) = quantiles[g * n_probs + q].get();
+    }
+    return out;
+}
+
+void add_density_reduction(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<DensityReduction>(m, "DensityReduction")
+            .def(py::init<int, const std::vector<double> &>())
+            .def("get_n_iter", &DensityReduction::get_n_iter)
+            .def("get_n_grid", &DensityReduction::get_n_grid)
+            .def("get_probs", &DensityReduction::get_probs)
+            .def("log_mean", &DensityReduction::log_mean)
+            .def("log_quantiles", &DensityReduction::log_quantiles);
+}
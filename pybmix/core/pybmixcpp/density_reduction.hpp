@@ -0,0 +1,77 @@
+#ifndef PYBMIX_DENSITY_REDUCTION_
+#define PYBMIX_DENSITY_REDUCTION_
+
+#include <pybind11/pybind11.h>
+
+#include <vector>
+#include <Eigen/Dense>
+
+//! Streaming estimate of a quantile with the P-square algorithm of Jain and
+//! Chlamtac (1985), which keeps five markers whatever the number of
+//! observations. The estimate is exact up to five observations.
+class P2Quantile {
+public:
+    explicit P2Quantile(double prob = 0.5);
+
+    void add(double x);
+
+    double get() const;
+
+protected:
+    //! Piecewise-parabolic prediction of the height of marker i moved by d
+    double parabolic(int i, int d) const;
+
+    double prob;
+    int count = 0;
+    double heights[5];
+    double positions[5];
+    double desired[5];
+    double increments[5];
+};
+
+//! Pointwise summaries of the posterior distribution of a density evaluated
+//! on a grid, computed from a stream of log densities without storing them.
+//!
+//! The mean density is reduced in log-space: every grid point keeps the
+//! running maximum m of the log densities and the sum of exp(lpdf - m), so
+//! that the log of the mean never underflows. Quantiles are estimated with
+//! one P2Quantile per grid point and probability. Distinct grid points can be
+//! updated concurrently.
+class DensityReduction {
+public:
+    DensityReduction() = default;
+
+    DensityReduction(int n_grid, const std::vector<double> &probs);
+
+    //! Adds the log densities of the grid points [start, start + lpdf.size())
+    //! for the current iteration
+    void add(int start, const Eigen::Ref<const Eigen::VectorXd> &lpdf);
+
+    //! Marks the end of an iteration, once all the grid points were added
+    void next_iteration() { n_iter++; }
+
+    int get_n_iter() const { return n_iter; }
+
+    int get_n_grid() const { return log_max.size(); }
+
+    const std::vector<double> &get_probs() const { return probs; }
+
+    //! Log of the pointwise mean density, NaN before the first iteration
+    Eigen::VectorXd log_mean() const;
+
+    //! Matrix of shape (n_probs, n_grid) with the pointwise quantiles of the
+    //! log density
+    Eigen::MatrixXd log_quantiles() const;
+
+protected:
+    std::vector<double> probs;
+    int n_iter = 0;
+    Eigen::VectorXd log_max;
+    Eigen::VectorXd scaled_sum;
+    //! Estimators of grid point g are in [g * probs.size(), (g + 1) * probs.size())
+    std::vector<P2Quantile> quantiles;
+};
+
+void add_density_reduction(pybind11::module &m);
+
+#endif
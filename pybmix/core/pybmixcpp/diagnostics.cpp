@@ -0,0 +1,77 @@
+#include "diagnostics.hpp"
+
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+#include <stan/math/prim.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+double effective_sample_size(const std::vector<double> &chain) {
+    const int n = chain.size();
+    if (n < 4) return n;
+
+    std::vector<double> acf;
+    stan::math::autocorrelation<double>(chain, acf);
+    if (!std::isfinite(acf[0])) return std::numeric_limits<double>::quiet_NaN();
+
+    // Sums of consecutive pairs of autocorrelations are positive and
+    // decreasing for reversible chains: stop at the first non-positive one
+    // and force monotonicity on the others
+    double sum = 0;
+    double prev = std::numeric_limits<double>::infinity();
+    for (int t = 0; t + 1 < n; t += 2) {
+        double pair = acf[t] + acf[t + 1];
+        if (pair <= 0) break;
+        prev = std::min(pair, prev);
+        sum += prev;
+    }
+    double tau = std::max(2 * sum - 1, 1.0 / std::log10(n));
+    return n / tau;
+}
+
+Eigen::VectorXd autocorrelation(const std::vector<double> &chain,
+                                unsigned int max_lag) {
+    if (chain.empty()) return Eigen::VectorXd(0);
+    std::vector<double> acf;
+    stan::math::autocorrelation<double>(chain, acf);
+    size_t n_lags = std::min<size_t>(max_lag, acf.size() - 1) + 1;
+    return Eigen::Map<const Eigen::VectorXd>(acf.data(), n_lags);
+}
+
+double split_rhat(const std::vector<std::vector<double>> &chains) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    if (chains.empty()) return nan;
+    size_t n = chains[0].size();
+    for (const auto &chain: chains) n = std::min(n, chain.size());
+    const size_t half = n / 2;
+    if (half < 2) return nan;
+
+    // Means and variances of the halves, the middle state of odd chains is
+    // dropped
+    std::vector<double> means, variances;
+    for (const auto &chain: chains) {
+        for (size_t start: {size_t(0), n - half}) {
+            Eigen::Map<const Eigen::ArrayXd> part(chain.data() + start, half);
+            double mean = part.mean();
+            means.push_back(mean);
+            variances.push_back((part - mean).square().sum() / (half - 1));
+        }
+    }
+    Eigen::Map<const Eigen::ArrayXd> m(means.data(), means.size());
+    double within = Eigen::Map<const Eigen::ArrayXd>(
+            variances.data(), variances.size()).mean();
+    double between = half * (m - m.mean()).square().sum() / (m.size() - 1);
+    if (!(within > 0)) return nan;
+    double var_plus = (half - 1.0) / half * within + between / half;
+    return std::sqrt(var_plus / within);
+}
+
+void add_diagnostics(pybind11::module &m) {
+    namespace py = pybind11;
+    m.def("effective_sample_size", &effective_sample_size);
+    m.def("autocorrelation", &autocorrelation, py::arg("chain"),
+          py::arg("max_lag") = 100);
+    m.def("split_rhat", &split_rhat, py::arg("chains"));
+}
@@ -0,0 +1,28 @@
+#ifndef PYBMIX_DIAGNOSTICS_
+#define PYBMIX_DIAGNOSTICS_
+
+#include <pybind11/pybind11.h>
+
+#include <vector>
+#include <Eigen/Dense>
+
+//! Effective sample size of a scalar chain, with the autocorrelations
+//! computed by FFT (stan::math::autocorrelation) and truncated with Geyer's
+//! initial monotone sequence estimator, as in Stan. Returns NaN for constant
+//! chains.
+double effective_sample_size(const std::vector<double> &chain);
+
+//! Autocorrelations of a scalar chain at lags 0, ..., min(max_lag, n - 1),
+//! computed by FFT
+Eigen::VectorXd autocorrelation(const std::vector<double> &chain,
+                                unsigned int max_lag);
+
+//! Split R-hat of scalar chains: every chain is split in two halves, which
+//! are compared as separate chains (Gelman et al., Bayesian Data Analysis,
+//! 3rd ed., Section 11.4). Chains are truncated to the shortest one. Returns
+//! NaN if the halves have less than two states or no variance.
+double split_rhat(const std::vector<std::vector<double>> &chains);
+
+void add_diagnostics(pybind11::module &m);
+
+#endif
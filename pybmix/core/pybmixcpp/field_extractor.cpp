@@ -0,0 +1,322 @@
+#include "field_extractor.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+namespace gp = google::protobuf;
+
+namespace {
+//! Returns the value of a scalar field, or of its index-th element if the
+//! field is repeated and index >= 0, converted to T
+template<typename T>
+T get_value(const gp::Message &msg, const gp::FieldDescriptor *field,
+            int index) {
+    const gp::Reflection *refl = msg.GetReflection();
+    bool rep = index >= 0;
+    switch (field->cpp_type()) {
+        case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+            return rep ? refl->GetRepeatedDouble(msg, field, index)
+                       : refl->GetDouble(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_FLOAT:
+            return rep ? refl->GetRepeatedFloat(msg, field, index)
+                       : refl->GetFloat(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_INT32:
+            return rep ? refl->GetRepeatedInt32(msg, field, index)
+                       : refl->GetInt32(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_INT64:
+            return rep ? refl->GetRepeatedInt64(msg, field, index)
+                       : refl->GetInt64(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_UINT32:
+            return rep ? refl->GetRepeatedUInt32(msg, field, index)
+                       : refl->GetUInt32(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_UINT64:
+            return rep ? refl->GetRepeatedUInt64(msg, field, index)
+                       : refl->GetUInt64(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_BOOL:
+            return rep ? refl->GetRepeatedBool(msg, field, index)
+                       : refl->GetBool(msg, field);
+        case gp::FieldDescriptor::CPPTYPE_ENUM:
+            return rep ? refl->GetRepeatedEnumValue(msg, field, index)
+                       : refl->GetEnumValue(msg, field);
+        default:
+            throw std::invalid_argument("Unsupported field " + field->full_name());
+    }
+}
+
+//! Returns the index-th element of a message field (the field itself if
+//! index < 0), nullptr if it does not exist
+const gp::Message *get_message(const gp::Message &msg,
+                               const gp::FieldDescriptor *field, int index) {
+    const gp::Reflection *refl = msg.GetReflection();
+    if (index < 0) {
+        return &refl->GetMessage(msg, field);
+    }
+    if (index >= refl->FieldSize(msg, field)) {
+        return nullptr;
+    }
+    return &refl->GetRepeatedMessage(msg, field, index);
+}
+}  // namespace
+
+FieldExtractor::FieldExtractor(const gp::Message &prototype,
+                               const std::string &path)
+        : prototype(prototype), path(path) {
+    const gp::Descriptor *desc = prototype.GetDescriptor();
+    size_t begin = 0;
+    while (true) {
+        size_t end = path.find('.', begin);
+        std::string part = path.substr(begin, end - begin);
+        int index = -1;
+        size_t bracket = part.find('[');
+        if (bracket != std::string::npos && part.back() == ']') {
+            index = std::stoi(part.substr(bracket + 1, part.size() - bracket - 2));
+            part = part.substr(0, bracket);
+        }
+
+        const gp::FieldDescriptor *field = desc->FindFieldByName(part);
+        if (field == nullptr) {
+            throw std::invalid_argument(
+                    "'" + part + "' is not a field of " + desc->full_name());
+        }
+        if (index >= 0 && !field->is_repeated()) {
+            throw std::invalid_argument("Field '" + part + "' is not repeated");
+        }
+        steps.push_back({field, index});
+
+        if (end == std::string::npos) break;
+        desc = field->message_type();
+        if (desc == nullptr) {
+            throw std::invalid_argument("Field '" + part + "' has no subfields");
+        }
+        if (field->is_repeated() && index < 0) {
+            throw std::invalid_argument(
+                    "An index is needed to access the elements of '" + part + "'");
+        }
+        begin = end + 1;
+    }
+
+    const Step &leaf = steps.back();
+    switch (leaf.field->cpp_type()) {
+        case gp::FieldDescriptor::CPPTYPE_MESSAGE: {
+            const std::string &name = leaf.field->message_type()->full_name();
+            if (leaf.field->is_repeated() && leaf.index < 0) {
+                throw std::invalid_argument(
+                        "Repeated message fields are not supported: " + path);
+            } else if (name == "bayesmix.Vector") {
+                kind = LeafKind::Vector;
+            } else if (name == "bayesmix.Matrix") {
+                kind = LeafKind::Matrix;
+            } else {
+                throw std::invalid_argument(
+                        "Messages of type " + name + " are not supported: " + path);
+            }
+            out_type = OutType::Float;
+            return;
+        }
+        case gp::FieldDescriptor::CPPTYPE_STRING:
+            throw std::invalid_argument("String fields are not supported: " + path);
+        case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+        case gp::FieldDescriptor::CPPTYPE_FLOAT:
+            out_type = OutType::Float;
+            break;
+        case gp::FieldDescriptor::CPPTYPE_BOOL:
+            out_type = OutType::Bool;
+            break;
+        default:
+            out_type = OutType::Int;
+    }
+    kind = (leaf.field->is_repeated() && leaf.index < 0) ? LeafKind::Repeated
+                                                         : LeafKind::Scalar;
+}
+
+const gp::Message *FieldExtractor::find_parent(const gp::Message &state) const {
+    const gp::Message *msg = &state;
+    for (size_t s = 0; s + 1 < steps.size() && msg != nullptr; s++) {
+        msg = get_message(*msg, steps[s].field, steps[s].index);
+    }
+    return msg;
+}
+
+bool FieldExtractor::leaf_shape(const gp::Message &state,
+                                std::vector <pybind11::ssize_t> *shape) const {
+    shape->clear();
+    const gp::Message *parent = find_parent(state);
+    if (parent == nullptr) return false;
+
+    const Step &leaf = steps.back();
+    const gp::Reflection *refl = parent->GetReflection();
+    switch (kind) {
+        case LeafKind::Scalar:
+            return leaf.index < 0 || leaf.index < refl->FieldSize(*parent, leaf.field);
+        case LeafKind::Repeated:
+            shape->push_back(refl->FieldSize(*parent, leaf.field));
+            return true;
+        case LeafKind::Vector:
+        case LeafKind::Matrix: {
+            const gp::Message *msg = get_message(*parent, leaf.field, leaf.index);
+            if (msg == nullptr) return false;
+            const gp::Descriptor *desc = msg->GetDescriptor();
+            const gp::Reflection *msg_refl = msg->GetReflection();
+            if (kind == LeafKind::Vector) {
+                shape->push_back(
+                        msg_refl->FieldSize(*msg, desc->FindFieldByName("data")));
+            } else {
+                shape->push_back(
+                        msg_refl->GetInt32(*msg, desc->FindFieldByName("rows")));
+                shape->push_back(
+                        msg_refl->GetInt32(*msg, desc->FindFieldByName("cols")));
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+FieldExtractor::ReadStatus FieldExtractor::read_leaf(
+        const gp::Message &state, const std::vector <pybind11::ssize_t> &shape,
+        T *out) const {
+    const gp::Message *parent = find_parent(state);
+    if (parent == nullptr) return ReadStatus::Missing;
+
+    const Step &leaf = steps.back();
+    const gp::Reflection *refl = parent->GetReflection();
+    switch (kind) {
+        case LeafKind::Scalar:
+            if (leaf.index >= 0 && leaf.index >= refl->FieldSize(*parent, leaf.field)) {
+                return ReadStatus::Missing;
+            }
+            out[0] = get_value<T>(*parent, leaf.field, leaf.index);
+            return ReadStatus::Ok;
+        case LeafKind::Repeated: {
+            int size = refl->FieldSize(*parent, leaf.field);
+            if (size != shape[0]) return ReadStatus::WrongSize;
+            for (int k = 0; k < size; k++) {
+                out[k] = get_value<T>(*parent, leaf.field, k);
+            }
+            return ReadStatus::Ok;
+        }
+        case LeafKind::Vector:
+        case LeafKind::Matrix: {
+            const gp::Message *msg = get_message(*parent, leaf.field, leaf.index);
+            if (msg == nullptr) return ReadStatus::Missing;
+            const gp::Descriptor *desc = msg->GetDescriptor();
+            const gp::Reflection *msg_refl = msg->GetReflection();
+            const gp::FieldDescriptor *data = desc->FindFieldByName("data");
+            int size = msg_refl->FieldSize(*msg, data);
+            if (kind == LeafKind::Vector) {
+                if (size != shape[0]) return ReadStatus::WrongSize;
+                for (int k = 0; k < size; k++) {
+                    out[k] = msg_refl->GetRepeatedDouble(*msg, data, k);
+                }
+                return ReadStatus::Ok;
+            }
+            int rows = msg_refl->GetInt32(*msg, desc->FindFieldByName("rows"));
+            int cols = msg_refl->GetInt32(*msg, desc->FindFieldByName("cols"));
+            bool rowmajor =
+                    msg_refl->GetBool(*msg, desc->FindFieldByName("rowmajor"));
+            if (rows != shape[0] || cols != shape[1] || size != rows * cols) {
+                return ReadStatus::WrongSize;
+            }
+            // The output is always row-major
+            for (int r = 0; r < rows; r++) {
+                for (int c = 0; c < cols; c++) {
+                    int k = rowmajor ? r * cols + c : c * rows + r;
+                    out[r * cols + c] = msg_refl->GetRepeatedDouble(*msg, data, k);
+                }
+            }
+            return ReadStatus::Ok;
+        }
+    }
+    return ReadStatus::Missing;
+}
+
+template<typename T>
+void FieldExtractor::fill(unsigned int n_states,
+                          const std::vector <pybind11::ssize_t> &shape,
+                          const StateLoader &load, T *out) const {
+    size_t width = 1;
+    for (auto dim: shape) width *= dim;
+
+    std::string error;
+#pragma omp parallel
+    {
+        std::unique_ptr <gp::Message> state(prototype.New());
+#pragma omp for schedule(dynamic, 64)
+        for (long i = 0; i < static_cast<long>(n_states); i++) {
+            try {
+                load(i, state.get());
+                ReadStatus status = read_leaf<T>(*state, shape, out + i * width);
+                if (status == ReadStatus::Missing &&
+                    std::is_floating_point<T>::value) {
+                    std::fill(out + i * width, out + (i + 1) * width,
+                              std::numeric_limits<T>::quiet_NaN());
+                } else if (status != ReadStatus::Ok) {
+                    throw std::out_of_range(
+                            "Field '" + path + "' is missing or has a different "
+                            "size at iteration " + std::to_string(i));
+                }
+            } catch (const std::exception &e) {
+#pragma omp critical
+                if (error.empty()) error = e.what();
+            }
+        }
+    }
+    if (!error.empty()) {
+        throw std::out_of_range(error);
+    }
+}
+
+pybind11::array FieldExtractor::extract(unsigned int n_states,
+                                        const StateLoader &load) const {
+    namespace py = pybind11;
+    // The shape of the field is taken from the first state where it exists
+    std::vector <py::ssize_t> shape;
+    std::unique_ptr <gp::Message> state(prototype.New());
+    bool found = false;
+    for (unsigned int i = 0; i < n_states && !found; i++) {
+        load(i, state.get());
+        found = leaf_shape(*state, &shape);
+    }
+    if (!found) {
+        throw std::out_of_range("Field '" + path + "' not found in the chain");
+    }
+    std::vector <py::ssize_t> out_shape = shape;
+    out_shape.insert(out_shape.begin(), n_states);
+
+    // The GIL is released only while filling, Python objects are created and
+    // returned while holding it
+    switch (out_type) {
+        case OutType::Float: {
+            py::array_t<double> out(out_shape);
+            double *data = out.mutable_data();
+            {
+                py::gil_scoped_release release;
+                fill<double>(n_states, shape, load, data);
+            }
+            return std::move(out);
+        }
+        case OutType::Int: {
+            py::array_t <int64_t> out(out_shape);
+            int64_t *data = out.mutable_data();
+            {
+                py::gil_scoped_release release;
+                fill<int64_t>(n_states, shape, load, data);
+            }
+            return std::move(out);
+        }
+        default: {
+            py::array_t<bool> out(out_shape);
+            bool *data = out.mutable_data();
+            {
+                py::gil_scoped_release release;
+                fill<bool>(n_states, shape, load, data);
+            }
+            return std::move(out);
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef PYBMIX_FIELD_EXTRACTOR_
+#define PYBMIX_FIELD_EXTRACTOR_
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//! Extracts one field from every state of a chain into a contiguous numpy
+//! array, without creating any Python object per iteration.
+//!
+//! The field path uses the same syntax of pybmix.utils.proto_utils.get_field,
+//! e.g. "cluster_allocs", "mixing_state.dp_state.totalmass" or
+//! "cluster_states[0].general_state". It is compiled once into a sequence of
+//! protobuf reflection accessors, then the states are parsed and read in
+//! parallel. Supported leaves are scalars (output of shape (n_states, )),
+//! repeated scalars (n_states, size), bayesmix.Vector (n_states, size) and
+//! bayesmix.Matrix (n_states, rows, cols). Integer and enum fields are
+//! returned as int64, boolean as bool, all the others as float64. Floating
+//! point leaves missing from some state (e.g. the state of a cluster that
+//! does not exist at that iteration) are set to NaN.
+class FieldExtractor {
+public:
+    //! Loads the i-th state of the chain into the message
+    using StateLoader =
+            std::function<void(unsigned int, google::protobuf::Message *)>;
+
+    //! Throws std::invalid_argument if `path` is not a valid field of
+    //! `prototype` or its type is not supported
+    FieldExtractor(const google::protobuf::Message &prototype,
+                   const std::string &path);
+
+    pybind11::array extract(unsigned int n_states, const StateLoader &load) const;
+
+protected:
+    enum class LeafKind { Scalar, Repeated, Vector, Matrix };
+
+    enum class OutType { Float, Int, Bool };
+
+    enum class ReadStatus { Ok, Missing, WrongSize };
+
+    struct Step {
+        const google::protobuf::FieldDescriptor *field;
+        //! Index into a repeated field, -1 if the field is not indexed
+        int index;
+    };
+
+    //! Follows the path down to the message holding the leaf field, returns
+    //! nullptr if an indexed element does not exist in this state
+    const google::protobuf::Message *
+    find_parent(const google::protobuf::Message &state) const;
+
+    //! Writes the shape of the leaf in a single state, returns false if the
+    //! leaf does not exist in this state
+    bool leaf_shape(const google::protobuf::Message &state,
+                    std::vector <pybind11::ssize_t> *shape) const;
+
+    //! Writes the values of the leaf in `out` in row-major order
+    template<typename T>
+    ReadStatus read_leaf(const google::protobuf::Message &state,
+                         const std::vector <pybind11::ssize_t> &shape,
+                         T *out) const;
+
+    //! Fills `out` with the values of the leaf in all the states, in parallel
+    template<typename T>
+    void fill(unsigned int n_states, const std::vector <pybind11::ssize_t> &shape,
+              const StateLoader &load, T *out) const;
+
+    const google::protobuf::Message &prototype;
+    std::string path;
+    std::vector <Step> steps;
+    LeafKind kind;
+    OutType out_type;
+};
+
+#endif
@@ -0,0 +1,206 @@
+#include "file_collector.hpp"
+
+#include "algorithm_state.pb.h"
+#include "field_extractor.hpp"
+
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace {
+//! Writes `value` as a base-128 varint and returns the number of bytes used
+int write_varint(uint64_t value, uint8_t *out) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+//! Offsets in the index are little-endian on every host
+void write_offset(uint64_t value, uint8_t *out) {
+    for (int b = 0; b < 8; b++) out[b] = static_cast<uint8_t>(value >> (8 * b));
+}
+
+uint64_t read_offset(const uint8_t *in) {
+    uint64_t value = 0;
+    for (int b = 0; b < 8; b++) value |= static_cast<uint64_t>(in[b]) << (8 * b);
+    return value;
+}
+
+std::FILE *open_or_throw(const std::string &path, const char *mode) {
+    std::FILE *out = std::fopen(path.c_str(), mode);
+    if (out == nullptr) {
+        throw std::runtime_error("Could not open file " + path);
+    }
+    return out;
+}
+}  // namespace
+
+StreamingFileCollector::StreamingFileCollector(const std::string &path)
+        : path(path) {}
+
+StreamingFileCollector::~StreamingFileCollector() { close_files(); }
+
+void StreamingFileCollector::start_collecting() {
+    close_files();
+    data_file = open_or_throw(path, "wb");
+    index_file = open_or_throw(get_index_path(), "wb");
+    offsets.clear();
+    file_size = 0;
+    size = 0;
+    read_pos = 0;
+}
+
+void StreamingFileCollector::finish_collecting() {
+    for (std::FILE **f: {&data_file, &index_file}) {
+        if (*f != nullptr) {
+            std::fclose(*f);
+            *f = nullptr;
+        }
+    }
+}
+
+void StreamingFileCollector::resume_collecting(uint64_t n_states) {
+    close_files();
+    if (offsets.empty()) {
+        std::FILE *index = std::fopen(get_index_path().c_str(), "rb");
+        if (index == nullptr) {
+            if (n_states > 0) throw std::runtime_error("Missing chain " + path);
+            start_collecting();
+            return;
+        }
+        uint8_t offset[8];
+        while (std::fread(offset, sizeof(offset), 1, index) == 1) {
+            offsets.push_back(read_offset(offset));
+        }
+        std::fclose(index);
+    }
+    if (n_states > offsets.size()) {
+        throw std::runtime_error("The chain in " + path + " has " +
+                                 std::to_string(offsets.size()) + " states, expected " +
+                                 std::to_string(n_states));
+    }
+
+    // States written after the checkpoint are dropped
+    if (n_states < offsets.size()) {
+        file_size = offsets[n_states];
+        offsets.resize(n_states);
+    } else {
+        std::FILE *data = open_or_throw(path, "rb");
+        std::fseek(data, 0, SEEK_END);
+        file_size = std::ftell(data);
+        std::fclose(data);
+    }
+    if (truncate(path.c_str(), file_size) != 0 ||
+        truncate(get_index_path().c_str(), n_states * sizeof(uint64_t)) != 0) {
+        throw std::runtime_error("Could not truncate the chain in " + path);
+    }
+    data_file = open_or_throw(path, "ab");
+    index_file = open_or_throw(get_index_path(), "ab");
+    size = n_states;
+    read_pos = 0;
+}
+
+void StreamingFileCollector::collect(const google::protobuf::Message &state) {
+    state.SerializeToString(&buffer);
+    uint8_t header[10];
+    int header_size = write_varint(buffer.size(), header);
+
+    uint8_t offset[8];
+    write_offset(file_size, offset);
+    if (std::fwrite(header, 1, header_size, data_file) != header_size ||
+        std::fwrite(buffer.data(), 1, buffer.size(), data_file) != buffer.size() ||
+        std::fwrite(offset, sizeof(offset), 1, index_file) != 1) {
+        throw std::runtime_error("Could not write the chain to " + path);
+    }
+    offsets.push_back(file_size);
+    file_size += header_size + buffer.size();
+    size++;
+}
+
+std::string StreamingFileCollector::get_state_string(unsigned int i) const {
+    check_not_busy();
+    if (i >= offsets.size()) {
+        throw std::out_of_range("State " + std::to_string(i) + " out of range");
+    }
+    prepare_read();
+    uint64_t end = (i + 1 < offsets.size()) ? offsets[i + 1] : file_size;
+    std::string record(end - offsets[i], '\0');
+    // pread does not move a shared file position, so concurrent reads are safe
+    if (pread(fileno(read_file), &record[0], record.size(), offsets[i]) !=
+        static_cast<ssize_t>(record.size())) {
+        throw std::runtime_error("Could not read the chain from " + path);
+    }
+    // Skip the varint with the size of the message
+    int header_size = 0;
+    while (static_cast<uint8_t>(record[header_size]) & 0x80) header_size++;
+    return record.substr(header_size + 1);
+}
+
+std::vector <pybind11::bytes> StreamingFileCollector::get_serialized_chain() const {
+    std::vector <pybind11::bytes> out(size);
+    for (int i = 0; i < size; i++) out[i] = get_serialized_state(i);
+
+    return out;
+}
+
+pybind11::array StreamingFileCollector::extract_field(const std::string &path) const {
+    check_not_busy();
+    FieldExtractor extractor(bayesmix::AlgorithmState::default_instance(), path);
+    return extractor.extract(
+            size, [this](unsigned int i, google::protobuf::Message *out) {
+                out->ParseFromString(get_state_string(i));
+            });
+}
+
+bool StreamingFileCollector::next_state(google::protobuf::Message *const out) {
+    if (read_pos == size) {
+        read_pos = 0;
+        return false;
+    }
+    out->ParseFromString(get_state_string(read_pos++));
+    return true;
+}
+
+void StreamingFileCollector::check_not_busy() const {
+    if (busy) {
+        throw std::runtime_error(
+                "The chain is being written by an asynchronous run: join its "
+                "handle first");
+    }
+}
+
+void StreamingFileCollector::prepare_read() const {
+    if (data_file != nullptr) {
+        std::fflush(data_file);
+    }
+    if (read_file == nullptr) {
+        read_file = open_or_throw(path, "rb");
+    }
+}
+
+void StreamingFileCollector::close_files() {
+    for (std::FILE **f: {&data_file, &index_file, &read_file}) {
+        if (*f != nullptr) {
+            std::fclose(*f);
+            *f = nullptr;
+        }
+    }
+}
+
+void add_streaming_file_collector(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<StreamingFileCollector, std::shared_ptr<StreamingFileCollector>>(
+            m, "StreamingFileCollector")
+            .def(py::init<const std::string &>())
+            .def("get_path", &StreamingFileCollector::get_path)
+            .def("get_index_path", &StreamingFileCollector::get_index_path)
+            .def("get_size", &StreamingFileCollector::get_size)
+            .def("get_serialized_state", &StreamingFileCollector::get_serialized_state)
+            .def("get_serialized_chain", &StreamingFileCollector::get_serialized_chain)
+            .def("extract_field", &StreamingFileCollector::extract_field);
+}
@@ -0,0 +1,94 @@
+#ifndef PYBMIX_FILE_COLLECTOR_
+#define PYBMIX_FILE_COLLECTOR_
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "bayesmix/src/collectors/base_collector.h"
+
+//! Collector that streams the states to disk as soon as they are produced,
+//! so that its memory footprint does not depend on the length of the chain.
+//!
+//! States are appended to `path` as length-delimited records, i.e. a varint
+//! with the size of the serialized message followed by the message itself
+//! (the same format of protobuf's SerializeDelimitedToOstream). The byte
+//! offset of every record is appended to `path + ".idx"` as a little-endian
+//! uint64, so that any state can be accessed in O(1), also from Python through
+//! a memory map (see pybmix.core.chain.MmapChain).
+class StreamingFileCollector : public BaseCollector {
+public:
+    explicit StreamingFileCollector(const std::string &path);
+
+    ~StreamingFileCollector();
+
+    void start_collecting() override;
+
+    void finish_collecting() override;
+
+    //! Reopens the chain for appending after finish_collecting, keeping its
+    //! first `n_states` states. If the chain was written by another object,
+    //! e.g. by a process which was stopped, its index is read from disk.
+    void resume_collecting(uint64_t n_states);
+
+    void collect(const google::protobuf::Message &state) override;
+
+    const std::string &get_path() const { return path; }
+
+    std::string get_index_path() const { return path + ".idx"; }
+
+    //! Returns the i-th serialized state, read from disk
+    std::string get_state_string(unsigned int i) const;
+
+    pybind11::bytes get_serialized_state(unsigned int i) const {
+        return (pybind11::bytes) get_state_string(i);
+    }
+
+    std::vector <pybind11::bytes> get_serialized_chain() const;
+
+    //! Returns the chain of one field as a numpy array, see FieldExtractor
+    pybind11::array extract_field(const std::string &path) const;
+
+    //! While set, another thread is writing the states, e.g. the worker of
+    //! AlgorithmWrapper::run_async, and reading them throws
+    void set_busy(bool busy_) { busy = busy_; }
+
+protected:
+    bool next_state(google::protobuf::Message *const out) override;
+
+    //! Flushes the pending writes and opens the file for reading if needed
+    void prepare_read() const;
+
+    //! Throws std::runtime_error while set_busy(true)
+    void check_not_busy() const;
+
+    std::atomic<bool> busy{false};
+
+    void close_files();
+
+    std::string path;
+
+    std::FILE *data_file = nullptr;
+    std::FILE *index_file = nullptr;
+    mutable std::FILE *read_file = nullptr;
+
+    //! Offsets of the records in the data file and current size of the file
+    std::vector <uint64_t> offsets;
+    uint64_t file_size = 0;
+
+    //! Position of the next state returned by next_state()
+    unsigned int read_pos = 0;
+
+    //! Reused serialization buffer
+    std::string buffer;
+};
+
+void add_streaming_file_collector(pybind11::module &m);
+
+#endif
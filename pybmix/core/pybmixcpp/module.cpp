@@ -5,7 +5,17 @@
 #include <pybind11/stl.h>
 
 #include "algorithm_wrapper.hpp"
+#include "checkpoint.hpp"
+#include "combinatorials.hpp"
+#include "compressed_chain.hpp"
 #include "bayesmix/src/utils/cluster_utils.h"
+#include "density_reduction.hpp"
+#include "diagnostics.hpp"
+#include "file_collector.hpp"
+#include "online_diagnostics.hpp"
+#include "partition_search.hpp"
+#include "psm.hpp"
+#include "run_handle.hpp"
 #include "serialized_collector.hpp"
 
 namespace py = pybind11;
@@ -14,5 +24,15 @@ PYBIND11_MODULE(pybmixcpp, m) {
   py::add_ostream_redirect(m, "ostream_redirect");
   add_algorithm_wrapper(m);
   add_serialized_collector(m);
+  add_streaming_file_collector(m);
+  add_checkpoint(m);
+  add_compressed_chain(m);
+  add_combinatorials(m);
+  add_run_handle(m);
+  add_density_reduction(m);
+  add_diagnostics(m);
+  add_online_diagnostics(m);
+  add_psm(m);
+  add_partition_search(m);
   m.def("_minbinder_cluster_estimate", &bayesmix::cluster_estimate);
 }
@@ -0,0 +1,169 @@
+#include "online_diagnostics.hpp"
+
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "diagnostics.hpp"
+
+void OnlineDiagnostics::BatchMeans::add(double value) {
+    partial += value;
+    if (++n_partial < batch_size) return;
+    sums.push_back(partial);
+    partial = 0;
+    n_partial = 0;
+    if (sums.size() < MAX_BATCHES) return;
+    for (unsigned int i = 0; i < MAX_BATCHES / 2; i++) {
+        sums[i] = sums[2 * i] + sums[2 * i + 1];
+    }
+    sums.resize(MAX_BATCHES / 2);
+    batch_size *= 2;
+}
+
+double OnlineDiagnostics::BatchMeans::ess(double variance) const {
+    const size_t n_batches = sums.size();
+    if (n_batches < 2) return std::numeric_limits<double>::quiet_NaN();
+    Eigen::ArrayXd means =
+            Eigen::Map<const Eigen::ArrayXd>(sums.data(), n_batches) / batch_size;
+    double var_means = (means - means.mean()).square().sum() / (n_batches - 1);
+    // The asymptotic variance of the mean is estimated by batch_size * var_means
+    return n_batches * variance / var_means;
+}
+
+double OnlineDiagnostics::Series::variance() const {
+    return trace.size() > 1 ? m2 / (trace.size() - 1) : 0.0;
+}
+
+unsigned int OnlineDiagnostics::get_index(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < series.size(); i++) {
+        if (series[i].name == name) return i;
+    }
+    series.emplace_back();
+    series.back().name = name;
+    return series.size() - 1;
+}
+
+void OnlineDiagnostics::add(unsigned int index, double value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Series &s = series[index];
+    s.trace.push_back(value);
+    double delta = value - s.mean;
+    s.mean += delta / s.trace.size();
+    s.m2 += delta * (value - s.mean);
+    s.batches.add(value);
+}
+
+void OnlineDiagnostics::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    series.clear();
+}
+
+std::vector<std::string> OnlineDiagnostics::get_names() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> out;
+    for (const auto &s: series) out.push_back(s.name);
+    return out;
+}
+
+const OnlineDiagnostics::Series &OnlineDiagnostics::find(
+        const std::string &name) const {
+    for (const auto &s: series) {
+        if (s.name == name) return s;
+    }
+    throw std::out_of_range("No diagnostics for '" + name + "'");
+}
+
+unsigned int OnlineDiagnostics::get_size(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return find(name).trace.size();
+}
+
+Eigen::VectorXd OnlineDiagnostics::get_trace(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto &trace = find(name).trace;
+    return Eigen::Map<const Eigen::VectorXd>(trace.data(), trace.size());
+}
+
+double OnlineDiagnostics::ess(const std::string &name,
+                              const std::string &method) const {
+    if (method == "batch_means") {
+        std::lock_guard<std::mutex> lock(mutex);
+        const Series &s = find(name);
+        return s.batches.ess(s.variance());
+    }
+    if (method != "fft") {
+        throw std::invalid_argument("'method' must be 'fft' or 'batch_means'");
+    }
+    // Copied, so that the sampler is not held up by the FFT
+    std::vector<double> trace;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        trace = find(name).trace;
+    }
+    return effective_sample_size(trace);
+}
+
+Eigen::VectorXd OnlineDiagnostics::autocorrelation(const std::string &name,
+                                                   unsigned int max_lag) const {
+    std::vector<double> trace;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        trace = find(name).trace;
+    }
+    return ::autocorrelation(trace, max_lag);
+}
+
+double OnlineDiagnostics::split_rhat(const std::string &name) const {
+    std::vector<std::vector<double>> chains(1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chains[0] = find(name).trace;
+    }
+    return ::split_rhat(chains);
+}
+
+pybind11::dict OnlineDiagnostics::summary() const {
+    namespace py = pybind11;
+    py::dict out;
+    for (const auto &name: get_names()) {
+        double mean, variance, ess_bm;
+        std::vector<std::vector<double>> chains(1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const Series &s = find(name);
+            chains[0] = s.trace;
+            mean = s.mean;
+            variance = s.variance();
+            ess_bm = s.batches.ess(variance);
+        }
+        py::dict stats;
+        stats["n"] = chains[0].size();
+        stats["mean"] = mean;
+        stats["sd"] = std::sqrt(variance);
+        stats["ess"] = effective_sample_size(chains[0]);
+        stats["ess_batch_means"] = ess_bm;
+        stats["split_rhat"] = ::split_rhat(chains);
+        out[name.c_str()] = stats;
+    }
+    return out;
+}
+
+void add_online_diagnostics(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<OnlineDiagnostics, std::shared_ptr<OnlineDiagnostics>>(
+            m, "OnlineDiagnostics")
+            .def("get_names", &OnlineDiagnostics::get_names)
+            .def("get_size", &OnlineDiagnostics::get_size)
+            .def("get_trace", &OnlineDiagnostics::get_trace)
+            .def("ess", &OnlineDiagnostics::ess, py::arg("name"),
+                 py::arg("method") = "fft")
+            .def("autocorrelation", &OnlineDiagnostics::autocorrelation,
+                 py::arg("name"), py::arg("max_lag") = 100)
+            .def("split_rhat", &OnlineDiagnostics::split_rhat)
+            .def("summary", &OnlineDiagnostics::summary);
+}
@@ -0,0 +1,90 @@
+#ifndef PYBMIX_ONLINE_DIAGNOSTICS_
+#define PYBMIX_ONLINE_DIAGNOSTICS_
+
+#include <pybind11/pybind11.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+//! Convergence diagnostics of scalar summaries of the states, updated by
+//! SerializedCollector as the states are collected, so that they can be
+//! queried during and after a run without deserializing the chain. Every
+//! summary keeps its running mean and variance, batch means and its trace,
+//! 8 bytes per state, on which the FFT-based diagnostics are computed when
+//! queried. Updates and queries may come from different threads.
+class OnlineDiagnostics {
+public:
+    //! Batch means with a number of batches between MAX_BATCHES / 2 and
+    //! MAX_BATCHES: when full, pairs of batches are merged and the batch
+    //! size doubles, so that memory and update cost are constant
+    struct BatchMeans {
+        static const unsigned int MAX_BATCHES = 64;
+
+        unsigned int batch_size = 1;
+        //! Sums of the completed batches
+        std::vector<double> sums;
+        double partial = 0;
+        unsigned int n_partial = 0;
+
+        void add(double value);
+
+        //! Effective sample size given the variance of the chain, NaN with
+        //! less than two batches
+        double ess(double variance) const;
+    };
+
+    OnlineDiagnostics() = default;
+
+    //! Index of the summary `name`, which is added if new
+    unsigned int get_index(const std::string &name);
+
+    void add(unsigned int index, double value);
+
+    //! Drops all the summaries
+    void reset();
+
+    std::vector<std::string> get_names() const;
+
+    //! Number of values of `name`
+    unsigned int get_size(const std::string &name) const;
+
+    Eigen::VectorXd get_trace(const std::string &name) const;
+
+    //! Effective sample size of `name`, with "fft" (see
+    //! effective_sample_size) or "batch_means"
+    double ess(const std::string &name, const std::string &method = "fft") const;
+
+    //! Autocorrelations of `name` at lags 0, ..., max_lag
+    Eigen::VectorXd autocorrelation(const std::string &name,
+                                    unsigned int max_lag) const;
+
+    //! Split R-hat of `name` within this chain, see split_rhat
+    double split_rhat(const std::string &name) const;
+
+    //! {name: {"n", "mean", "sd", "ess", "ess_batch_means", "split_rhat"}}
+    pybind11::dict summary() const;
+
+protected:
+    struct Series {
+        std::string name;
+        std::vector<double> trace;
+        //! Welford's running mean and sum of squared deviations
+        double mean = 0;
+        double m2 = 0;
+        BatchMeans batches;
+
+        double variance() const;
+    };
+
+    //! Throws std::out_of_range if `name` is not a summary
+    const Series &find(const std::string &name) const;
+
+    mutable std::mutex mutex;
+    std::vector<Series> series;
+};
+
+void add_online_diagnostics(pybind11::module &m);
+
+#endif
@@ -0,0 +1,301 @@
+#include "partition_search.hpp"
+
+#include <pybind11/eigen.h>
+#include <pybind11/stl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+double xlogx(double x) { return x > 0 ? x * std::log(x) : 0.0; }
+
+//! Relabels the clusters as 0, 1, ... in order of first appearance
+Eigen::VectorXi relabel(const std::vector<int> &labels) {
+    Eigen::VectorXi out(labels.size());
+    std::vector<int> map(labels.size(), -1);
+    int next = 0;
+    for (size_t i = 0; i < labels.size(); i++) {
+        if (map[labels[i]] < 0) map[labels[i]] = next++;
+        out(i) = map[labels[i]];
+    }
+    return out;
+}
+}  // namespace
+
+PartitionSearch::PartitionSearch(const PosteriorSimilarity &psm, Loss loss,
+                                 double a, double b)
+        : psm(psm), loss_type(loss), a(a), b(b), n(psm.get_n()) {
+    if (a <= 0 || b <= 0) {
+        throw std::invalid_argument("Binder costs must be positive");
+    }
+    if (loss_type == Loss::VI) {
+        psm.visit([this](const auto *p) {
+            double sum = 0.0;
+#pragma omp parallel reduction(+ : sum)
+            {
+                std::vector<double> row(n);
+#pragma omp for schedule(dynamic, 64)
+                for (int i = 0; i < n; i++) {
+                    load_row(p, i, row.data());
+                    sum += std::log2(std::accumulate(row.begin(), row.end(), 0.0));
+                }
+            }
+            log_row_sums = sum;
+        });
+    }
+}
+
+template<typename T>
+void PartitionSearch::load_row(const T *p, int i, double *row) const {
+    for (int j = 0; j < i; j++) row[j] = PosteriorSimilarity::decode(p[psm.offset(j, i)]);
+    row[i] = 1.0;
+    for (int j = i + 1; j < n; j++) row[j] = PosteriorSimilarity::decode(p[psm.offset(i, j)]);
+}
+
+template<typename T>
+bool PartitionSearch::reassign(const T *p, int i, int max_clusters,
+                               State *state) const {
+    auto &labels = state->labels;
+    auto &sizes = state->sizes;
+    auto &s = state->within_sums;
+    double *row = state->row.data();
+    const bool vi = loss_type == Loss::VI;
+    load_row(p, i, row);
+
+    // Take item i out of its cluster
+    const int old = labels[i];
+    if (old >= 0) {
+        labels[i] = -1;
+        if (vi) {
+            for (int j = 0; j < n; j++) {
+                if (labels[j] == old) s[j] -= row[j];
+            }
+        }
+        if (--sizes[old] == 0) state->n_clusters--;
+    }
+
+    // For every cluster k, sums[k] = sum_{j in k} p_ij and, for VI,
+    // log_ratios[k] = sum_{j in k} log(s_j + p_ij) - log(s_j)
+    const int n_labels = sizes.size();
+    std::fill(state->sums.begin(), state->sums.begin() + n_labels, 0.0);
+    if (vi) std::fill(state->log_ratios.begin(), state->log_ratios.begin() + n_labels, 0.0);
+    for (int j = 0; j < n; j++) {
+        const int k = labels[j];
+        if (k < 0) continue;
+        state->sums[k] += row[j];
+        if (vi) state->log_ratios[k] += std::log1p(row[j] / s[j]);
+    }
+
+    // Change of the loss when i joins cluster k, up to a constant. A new
+    // cluster has delta 0. Ties are broken in favour of the old cluster, so
+    // that sweeps terminate.
+    auto delta = [&](int k) {
+        if (sizes[k] == 0) return 0.0;
+        if (!vi) return a * sizes[k] - (a + b) * state->sums[k];
+        return xlogx(sizes[k] + 1.0) - xlogx(sizes[k]) - 2 * state->log_ratios[k] -
+               2 * std::log1p(state->sums[k]);
+    };
+    const bool can_open = max_clusters <= 0 || state->n_clusters < max_clusters;
+    int best = -1;
+    double best_delta = std::numeric_limits<double>::infinity();
+    if (old >= 0 && (sizes[old] > 0 || can_open)) {
+        best = old;
+        best_delta = delta(old);
+    }
+    if (can_open && best_delta > 1e-12) {
+        best = -1;
+        best_delta = 0.0;
+    }
+    for (int k = 0; k < n_labels; k++) {
+        if (sizes[k] == 0 || k == old) continue;
+        double d = delta(k);
+        if (d < best_delta - 1e-12) {
+            best = k;
+            best_delta = d;
+        }
+    }
+
+    // Open a new cluster, reusing the old label or a free one
+    if (best < 0) {
+        if (old >= 0 && sizes[old] == 0) {
+            best = old;
+        } else if (!state->free_labels.empty()) {
+            best = state->free_labels.back();
+            state->free_labels.pop_back();
+        } else {
+            best = n_labels;
+            sizes.push_back(0);
+            state->sums.push_back(0.0);
+            state->log_ratios.push_back(0.0);
+        }
+    }
+    if (old >= 0 && sizes[old] == 0 && best != old) state->free_labels.push_back(old);
+
+    if (vi) {
+        for (int j = 0; j < n; j++) {
+            if (labels[j] == best) s[j] += row[j];
+        }
+        s[i] = 1.0 + (sizes[best] > 0 ? state->sums[best] : 0.0);
+    }
+    if (sizes[best]++ == 0) state->n_clusters++;
+    labels[i] = best;
+    return best != old;
+}
+
+template<typename T>
+PartitionSearch::Result PartitionSearch::run(const T *p, int max_sweeps,
+                                             int max_clusters,
+                                             std::mt19937 *rng) const {
+    State state;
+    state.labels.assign(n, -1);
+    state.within_sums.assign(n, 0.0);
+    state.row.resize(n);
+
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+
+    // Sequential allocation, then sweeps until no item moves
+    std::shuffle(order.begin(), order.end(), *rng);
+    for (int i: order) reassign(p, i, max_clusters, &state);
+
+    int n_sweeps = 0;
+    bool changed = true;
+    while (changed && n_sweeps < max_sweeps) {
+        changed = false;
+        std::shuffle(order.begin(), order.end(), *rng);
+        for (int i: order) changed |= reassign(p, i, max_clusters, &state);
+        n_sweeps++;
+    }
+
+    Result out;
+    out.partition = relabel(state.labels);
+    out.loss = partition_loss(p, out.partition.data(), 1, &state.row);
+    out.n_sweeps = n_sweeps;
+    return out;
+}
+
+template<typename T>
+double PartitionSearch::partition_loss(const T *p, const int *labels, int stride,
+                                       std::vector<double> *row) const {
+    // Binder: b sum_{i < j} p_ij + sum_{i < j, c_i = c_j} (a - (a + b) p_ij)
+    // VI: (sum_i log2 n_{c_i} - 2 log2 s_i + log2 sum_j p_ij) / n
+    std::vector<int> sizes;
+    for (int i = 0; i < n; i++) {
+        if (labels[i * stride] < 0) throw std::invalid_argument("Negative cluster label");
+        if (labels[i * stride] >= static_cast<int>(sizes.size())) {
+            sizes.resize(labels[i * stride] + 1, 0);
+        }
+        sizes[labels[i * stride]]++;
+    }
+
+    double out = loss_type == Loss::Binder ? b * psm.pair_sum() : log_row_sums;
+    for (int i = 0; i < n; i++) {
+        load_row(p, i, row->data());
+        const int label = labels[i * stride];
+        if (loss_type == Loss::Binder) {
+            for (int j = i + 1; j < n; j++) {
+                if (labels[j * stride] == label) out += a - (a + b) * (*row)[j];
+            }
+        } else {
+            double s = 0.0;
+            for (int j = 0; j < n; j++) {
+                if (labels[j * stride] == label) s += (*row)[j];
+            }
+            out += std::log2(sizes[label]) - 2 * std::log2(s);
+        }
+    }
+    return loss_type == Loss::Binder ? out : out / n;
+}
+
+PartitionSearch::Result PartitionSearch::search(int n_restarts, int max_sweeps,
+                                                int max_clusters,
+                                                unsigned int seed) const {
+    if (n_restarts < 1) {
+        throw std::invalid_argument("At least one restart is required");
+    }
+    std::vector<Result> results(n_restarts);
+    psm.visit([&](const auto *p) {
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int r = 0; r < n_restarts; r++) {
+            std::mt19937 rng(seed + r);
+            results[r] = run(p, max_sweeps, max_clusters, &rng);
+        }
+    });
+    return *std::min_element(
+            results.begin(), results.end(),
+            [](const Result &x, const Result &y) { return x.loss < y.loss; });
+}
+
+double PartitionSearch::loss(const Eigen::Ref<const Eigen::VectorXi> &partition) const {
+    if (partition.size() != n) {
+        throw std::invalid_argument(
+                "Expected a partition of " + std::to_string(n) + " items, found " +
+                std::to_string(partition.size()));
+    }
+    std::vector<double> row(n);
+    return psm.visit([&](const auto *p) {
+        return partition_loss(p, partition.data(), partition.innerStride(), &row);
+    });
+}
+
+Eigen::VectorXd PartitionSearch::losses(
+        const Eigen::Ref<const PosteriorSimilarity::AllocationMatrix> &allocs) const {
+    if (allocs.cols() != n) {
+        throw std::invalid_argument(
+                "Expected partitions of " + std::to_string(n) + " items, found " +
+                std::to_string(allocs.cols()));
+    }
+    Eigen::VectorXd out(allocs.rows());
+    psm.visit([&](const auto *p) {
+#pragma omp parallel
+        {
+            std::vector<double> row(n);
+#pragma omp for schedule(dynamic, 16)
+            for (long t = 0; t < allocs.rows(); t++) {
+                out(t) = partition_loss(p, allocs.data() + t * allocs.outerStride(),
+                                        1, &row);
+            }
+        }
+    });
+    return out;
+}
+
+PartitionSearch::Loss PartitionSearch::loss_from_string(const std::string &name) {
+    if (name == "binder") return Loss::Binder;
+    if (name == "vi") return Loss::VI;
+    throw std::invalid_argument(
+            "Unknown loss '" + name + "', expected one of binder, vi");
+}
+
+void add_partition_search(pybind11::module &m) {
+    namespace py = pybind11;
+
+    m.def("_salso_cluster_estimate",
+          [](const PosteriorSimilarity &psm, const std::string &loss, double a,
+             double b, int n_restarts, int max_sweeps, int max_clusters,
+             unsigned int seed) {
+              auto loss_type = PartitionSearch::loss_from_string(loss);
+              py::gil_scoped_release release;
+              PartitionSearch search(psm, loss_type, a, b);
+              auto result = search.search(n_restarts, max_sweeps, max_clusters, seed);
+              return std::make_tuple(result.partition, result.loss, result.n_sweeps);
+          },
+          py::arg("psm"), py::arg("loss") = "binder", py::arg("a") = 1.0,
+          py::arg("b") = 1.0, py::arg("n_restarts") = 16,
+          py::arg("max_sweeps") = 100, py::arg("max_clusters") = 0,
+          py::arg("seed") = 0);
+
+    m.def("_partition_losses",
+          [](const PosteriorSimilarity &psm,
+             const Eigen::Ref<const PosteriorSimilarity::AllocationMatrix> &allocs,
+             const std::string &loss, double a, double b) {
+              auto loss_type = PartitionSearch::loss_from_string(loss);
+              py::gil_scoped_release release;
+              return PartitionSearch(psm, loss_type, a, b).losses(allocs);
+          },
+          py::arg("psm"), py::arg("allocs"), py::arg("loss") = "binder",
+          py::arg("a") = 1.0, py::arg("b") = 1.0);
+}
@@ -0,0 +1,99 @@
+#ifndef PYBMIX_PARTITION_SEARCH_
+#define PYBMIX_PARTITION_SEARCH_
+
+#include <pybind11/pybind11.h>
+
+#include <random>
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+#include "psm.hpp"
+
+//! Greedy search of the partition minimizing the posterior expected loss,
+//! in the spirit of SALSO (Dahl, Johnson and Mueller, 2022).
+//!
+//! Every restart allocates the items one at a time in random order, each to
+//! the cluster (possibly a new one) that minimizes the loss of the items
+//! allocated so far, then sweeps over the items reassigning one item at a
+//! time until no item moves. The change of the loss when a single item moves
+//! is computed incrementally in O(n). Restarts run in parallel, restart r
+//! draws from its own std::mt19937 seeded with seed + r.
+//!
+//! Supported losses are Binder with cost `a` for clustering together two
+//! items that are apart and `b` for separating two items that are together,
+//! and the lower bound of the expected Variation of Information of Wade and
+//! Ghahramani (2018), in bits.
+class PartitionSearch {
+public:
+    enum class Loss { Binder, VI };
+
+    struct Result {
+        Eigen::VectorXi partition;
+        double loss;
+        int n_sweeps;
+    };
+
+    PartitionSearch(const PosteriorSimilarity &psm, Loss loss, double a = 1.0,
+                    double b = 1.0);
+
+    //! Returns the best partition found by `n_restarts` restarts with at most
+    //! `max_sweeps` sweeps each. If `max_clusters` is positive, partitions
+    //! have at most that many clusters. Labels are 0, 1, ... in order of
+    //! first appearance.
+    Result search(int n_restarts, int max_sweeps, int max_clusters,
+                  unsigned int seed) const;
+
+    //! Expected loss of a partition
+    double loss(const Eigen::Ref<const Eigen::VectorXi> &partition) const;
+
+    //! Expected loss of each partition (row) in `allocs`, in parallel
+    Eigen::VectorXd losses(const Eigen::Ref<const PosteriorSimilarity::AllocationMatrix> &allocs) const;
+
+    static Loss loss_from_string(const std::string &name);
+
+protected:
+    //! Bookkeeping of a partition under construction, label -1 means that
+    //! the item is not allocated yet
+    struct State {
+        std::vector<int> labels;
+        std::vector<int> sizes;
+        std::vector<int> free_labels;
+        //! For VI, sum of p_ij over the items j in the cluster of item i
+        std::vector<double> within_sums;
+        int n_clusters = 0;
+        //! Buffers for the row of the PSM and the per-cluster accumulators
+        std::vector<double> row;
+        std::vector<double> sums;
+        std::vector<double> log_ratios;
+    };
+
+    //! Writes P(c_i = c_j) for all j in `row`
+    template<typename T>
+    void load_row(const T *p, int i, double *row) const;
+
+    //! Moves item i to the cluster minimizing the loss, returns true if its
+    //! label changed
+    template<typename T>
+    bool reassign(const T *p, int i, int max_clusters, State *state) const;
+
+    template<typename T>
+    Result run(const T *p, int max_sweeps, int max_clusters,
+               std::mt19937 *rng) const;
+
+    template<typename T>
+    double partition_loss(const T *p, const int *labels, int stride,
+                          std::vector<double> *row) const;
+
+    const PosteriorSimilarity &psm;
+    Loss loss_type;
+    double a;
+    double b;
+    int n;
+    //! For VI, sum over i of log2(sum_j p_ij), the constant of the bound
+    double log_row_sums = 0.0;
+};
+
+void add_partition_search(pybind11::module &m);
+
+#endif
@@ -0,0 +1,100 @@
+#include "profiler.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+//! Small consecutive ids for the trace, in order of first use
+int thread_index() {
+    static std::atomic<int> next_index{0};
+    thread_local int index = next_index++;
+    return index;
+}
+}  // namespace
+
+const char *Profiler::name(Phase phase) {
+    switch (phase) {
+        case Run: return "run";
+        case Initialize: return "initialize";
+        case Iteration: return "iteration";
+        case Collect: return "collector.collect";
+        case CollectCallback: return "collector.callback";
+        case StoreState: return "collector.store_state";
+        case DatumMove: return "hierarchy.datum_move";
+        case SampleFullCond: return "hierarchy.sample_full_cond";
+        case UpdateHypers: return "hierarchy.update_hypers";
+        case PyLikeLpdf: return "python.like_lpdf";
+        case PyMargLpdf: return "python.marg_lpdf";
+        case PyLpdfBatch: return "python.lpdf_batch";
+        case PyDraw: return "python.draw";
+        case PyPosteriorHypers: return "python.compute_posterior_hypers";
+        case PySampleFullCond: return "python.sample_full_cond";
+        case PySummaryStatistics: return "python.update_summary_statistics";
+        case PySuffStat: return "python.suff_stat";
+        case PyUpdateHypers: return "python.update_hypers";
+        case PyInitialize: return "python.initialize";
+        case NativeCall: return "native.calls";
+        default: return "unknown";
+    }
+}
+
+int64_t Profiler::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::start(bool trace) {
+    for (auto &stat: stats) {
+        stat.count = 0;
+        stat.total_ns = 0;
+    }
+    {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events.clear();
+        dropped_events = 0;
+        tracing.store(trace, std::memory_order_relaxed);
+    }
+    origin_ns = now_ns();
+    enabled = true;
+}
+
+void Profiler::add(Phase phase, int64_t start_ns, int64_t duration_ns) {
+    stats[phase].count.fetch_add(1, std::memory_order_relaxed);
+    stats[phase].total_ns.fetch_add(duration_ns, std::memory_order_relaxed);
+    if (!tracing.load(std::memory_order_relaxed)) return;
+    std::lock_guard<std::mutex> lock(events_mutex);
+    if (events.size() < MAX_EVENTS) {
+        events.push_back({phase, thread_index(), start_ns, duration_ns});
+    } else {
+        dropped_events++;
+    }
+}
+
+std::vector<Profiler::Stat> Profiler::snapshot() const {
+    std::vector<Stat> out(NUM_PHASES);
+    for (int p = 0; p < NUM_PHASES; p++) {
+        out[p].count = stats[p].count.load();
+        out[p].total_ns = stats[p].total_ns.load();
+    }
+    return out;
+}
+
+void Profiler::write_trace(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Cannot open " + path);
+    std::lock_guard<std::mutex> lock(events_mutex);
+    out << std::fixed;
+    out.precision(3);
+    out << "{\"traceEvents\": [";
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event &ev = events[i];
+        // Timestamps and durations in microseconds from the start
+        out << (i ? ",\n" : "\n") << "{\"name\": \"" << name(ev.phase)
+            << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << ev.thread
+            << ", \"ts\": " << (ev.start_ns - origin_ns) / 1e3
+            << ", \"dur\": " << ev.duration_ns / 1e3 << "}";
+    }
+    out << "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped_events\": "
+        << dropped_events << "}}\n";
+}
@@ -0,0 +1,133 @@
+#ifndef PYBMIX_PROFILER_
+#define PYBMIX_PROFILER_
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Process-wide, opt-in instrumentation of the phases of a run. Every phase
+//! accumulates its number of calls and total time; phases nest, e.g. a
+//! datum move includes the Python call updating the summary statistics.
+//! While disabled, a ScopedTimer costs a single relaxed atomic load.
+//!
+//! When tracing, every timed call is also recorded as a Chrome trace event
+//! (chrome://tracing, Perfetto), up to MAX_EVENTS events.
+class Profiler {
+public:
+    enum Phase : int {
+        Run,
+        Initialize,
+        //! Time between two consecutive collected states
+        Iteration,
+        Collect,
+        CollectCallback,
+        StoreState,
+        DatumMove,
+        SampleFullCond,
+        UpdateHypers,
+        PyLikeLpdf,
+        PyMargLpdf,
+        PyLpdfBatch,
+        PyDraw,
+        PyPosteriorHypers,
+        PySampleFullCond,
+        PySummaryStatistics,
+        PySuffStat,
+        PyUpdateHypers,
+        PyInitialize,
+        //! Calls of native hierarchy callbacks, counted but not timed
+        NativeCall,
+        NUM_PHASES
+    };
+
+    struct Stat {
+        int64_t count = 0;
+        int64_t total_ns = 0;
+    };
+
+    static const size_t MAX_EVENTS = 1 << 20;
+
+    static Profiler &Instance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    static const char *name(Phase phase);
+
+    //! Nanoseconds on a monotonic clock
+    static int64_t now_ns();
+
+    bool is_enabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    //! Resets all the statistics and starts collecting them, with trace
+    //! events if `trace` is true
+    void start(bool trace);
+
+    void stop() { enabled = false; }
+
+    void add(Phase phase, int64_t start_ns, int64_t duration_ns);
+
+    void count(Phase phase) {
+        if (is_enabled()) stats[phase].count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //! Statistics of all the phases, indexed by Phase
+    std::vector<Stat> snapshot() const;
+
+    //! Writes the trace events to `path` in the Chrome trace-event format
+    void write_trace(const std::string &path) const;
+
+protected:
+    Profiler() = default;
+
+    struct AtomicStat {
+        std::atomic<int64_t> count{0};
+        std::atomic<int64_t> total_ns{0};
+    };
+
+    struct Event {
+        Phase phase;
+        int thread;
+        int64_t start_ns;
+        int64_t duration_ns;
+    };
+
+    std::atomic<bool> enabled{false};
+    //! Read by add() without the lock, from any thread
+    std::atomic<bool> tracing{false};
+    int64_t origin_ns = 0;
+    std::array<AtomicStat, NUM_PHASES> stats;
+
+    mutable std::mutex events_mutex;
+    std::vector<Event> events;
+    size_t dropped_events = 0;
+};
+
+//! Adds the time between its construction and destruction to `phase`
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Profiler::Phase phase)
+            : phase(phase), active(Profiler::Instance().is_enabled()) {
+        if (active) start_ns = Profiler::now_ns();
+    }
+
+    ~ScopedTimer() {
+        if (active) {
+            Profiler::Instance().add(phase, start_ns, Profiler::now_ns() - start_ns);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+protected:
+    Profiler::Phase phase;
+    bool active;
+    int64_t start_ns = 0;
+};
+
+#endif
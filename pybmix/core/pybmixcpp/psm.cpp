@@ -0,0 +1,227 @@
+#include "psm.hpp"
+
+#include <pybind11/eigen.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+template<typename T>
+T encode(uint32_t count, int n_iter) {
+    return static_cast<T>(static_cast<double>(count) / n_iter);
+}
+
+template<>
+uint16_t encode<uint16_t>(uint32_t count, int n_iter) {
+    return static_cast<uint16_t>(std::lround(65535.0 * count / n_iter));
+}
+
+const char *storage_name(PosteriorSimilarity::Storage storage) {
+    switch (storage) {
+        case PosteriorSimilarity::Storage::Float64:
+            return "float64";
+        case PosteriorSimilarity::Storage::Float32:
+            return "float32";
+        default:
+            return "uint16";
+    }
+}
+}  // namespace
+
+PosteriorSimilarity::PosteriorSimilarity(
+        const Eigen::Ref<const AllocationMatrix> &allocs, Storage storage,
+        bool packed)
+        : n(allocs.cols()), n_iter(allocs.rows()), storage(storage),
+          packed(packed) {
+    if (n_iter == 0) {
+        throw std::invalid_argument(
+                "Cannot compute the posterior similarity of an empty chain");
+    }
+    size_t size = packed ? size_t(n) * (n - 1) / 2 : size_t(n) * n;
+    switch (storage) {
+        case Storage::Float64:
+            values = std::vector<double>(size);
+            break;
+        case Storage::Float32:
+            values = std::vector<float>(size);
+            break;
+        case Storage::UInt16:
+            values = std::vector<uint16_t>(size);
+            break;
+    }
+    std::visit([this, &allocs](auto &v) { fill(allocs, v.data()); }, values);
+}
+
+template<typename T>
+void PosteriorSimilarity::fill(const Eigen::Ref<const AllocationMatrix> &allocs,
+                               T *out) {
+    int n_tiles = (n + TILE_SIZE - 1) / TILE_SIZE;
+    std::vector <std::pair<int, int>> tiles;
+    for (int bi = 0; bi < n_tiles; bi++) {
+        for (int bj = bi; bj < n_tiles; bj++) tiles.emplace_back(bi, bj);
+    }
+
+    double sum = 0.0;
+#pragma omp parallel reduction(+ : sum)
+    {
+        std::vector <uint32_t> counts(TILE_SIZE * TILE_SIZE);
+#pragma omp for schedule(dynamic)
+        for (long k = 0; k < static_cast<long>(tiles.size()); k++) {
+            int i0 = tiles[k].first * TILE_SIZE;
+            int i1 = std::min(i0 + TILE_SIZE, n);
+            int j0 = tiles[k].second * TILE_SIZE;
+            int j1 = std::min(j0 + TILE_SIZE, n);
+            std::fill(counts.begin(), counts.end(), 0);
+
+            for (int t = 0; t < n_iter; t++) {
+                const int32_t *row = allocs.data() + t * allocs.outerStride();
+                for (int i = i0; i < i1; i++) {
+                    const int32_t label = row[i];
+                    uint32_t *count = counts.data() + (i - i0) * TILE_SIZE;
+                    for (int j = std::max(j0, i + 1); j < j1; j++) {
+                        count[j - j0] += (row[j] == label);
+                    }
+                }
+            }
+
+            for (int i = i0; i < i1; i++) {
+                for (int j = std::max(j0, i + 1); j < j1; j++) {
+                    T value = encode<T>(counts[(i - i0) * TILE_SIZE + j - j0], n_iter);
+                    out[offset(i, j)] = value;
+                    if (!packed) out[int64_t(j) * n + i] = value;
+                    sum += decode(value);
+                }
+            }
+        }
+    }
+
+    if (!packed) {
+        for (int i = 0; i < n; i++) out[int64_t(i) * n + i] = encode<T>(n_iter, n_iter);
+    }
+    sum_pairs = sum;
+}
+
+size_t PosteriorSimilarity::nbytes() const {
+    return std::visit([](const auto &v) {
+        return v.size() * sizeof(typename std::decay_t<decltype(v)>::value_type);
+    }, values);
+}
+
+double PosteriorSimilarity::operator()(int i, int j) const {
+    if (i < 0 || j < 0 || i >= n || j >= n) {
+        throw std::out_of_range("Item index out of range");
+    }
+    if (i == j) return 1.0;
+    if (i > j) std::swap(i, j);
+    return visit([this, i, j](const auto *p) { return decode(p[offset(i, j)]); });
+}
+
+Eigen::MatrixXd PosteriorSimilarity::to_dense() const {
+    Eigen::MatrixXd out(n, n);
+    visit([this, &out](const auto *p) {
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int i = 0; i < n; i++) {
+            out(i, i) = 1.0;
+            for (int j = i + 1; j < n; j++) {
+                out(i, j) = out(j, i) = decode(p[offset(i, j)]);
+            }
+        }
+    });
+    return out;
+}
+
+Eigen::VectorXd PosteriorSimilarity::binder_losses(
+        const Eigen::Ref<const AllocationMatrix> &allocs, double a,
+        double b) const {
+    if (allocs.cols() != n) {
+        throw std::invalid_argument(
+                "Expected partitions of " + std::to_string(n) + " items, found " +
+                std::to_string(allocs.cols()));
+    }
+    // loss = b sum_{i < j} p_ij + sum_{i < j, c_i = c_j} (a - (a + b) p_ij),
+    // so only the pairs in the same cluster must be visited
+    Eigen::VectorXd out(allocs.rows());
+    visit([&](const auto *p) {
+#pragma omp parallel
+        {
+            std::vector<int> order(n);
+#pragma omp for schedule(dynamic, 16)
+            for (long t = 0; t < allocs.rows(); t++) {
+                const int32_t *row = allocs.data() + t * allocs.outerStride();
+                std::iota(order.begin(), order.end(), 0);
+                std::stable_sort(order.begin(), order.end(),
+                                 [row](int i, int j) { return row[i] < row[j]; });
+
+                double together = 0.0;
+                for (int start = 0, end; start < n; start = end) {
+                    for (end = start; end < n && row[order[end]] == row[order[start]];) {
+                        end++;
+                    }
+                    for (int x = start; x < end; x++) {
+                        for (int y = x + 1; y < end; y++) {
+                            together += a - (a + b) * decode(p[offset(order[x], order[y])]);
+                        }
+                    }
+                }
+                out(t) = b * sum_pairs + together;
+            }
+        }
+    });
+    return out;
+}
+
+PosteriorSimilarity::Storage
+PosteriorSimilarity::storage_from_string(const std::string &name) {
+    if (name == "float64") return Storage::Float64;
+    if (name == "float32") return Storage::Float32;
+    if (name == "uint16") return Storage::UInt16;
+    throw std::invalid_argument(
+            "Unknown storage '" + name + "', expected one of float64, float32, uint16");
+}
+
+void add_psm(pybind11::module &m) {
+    namespace py = pybind11;
+    using Allocations = Eigen::Ref<const PosteriorSimilarity::AllocationMatrix>;
+
+    py::class_<PosteriorSimilarity>(m, "PosteriorSimilarity")
+            .def(py::init([](const Allocations &allocs, const std::string &dtype,
+                             bool packed) {
+                     auto storage = PosteriorSimilarity::storage_from_string(dtype);
+                     py::gil_scoped_release release;
+                     return std::make_unique<PosteriorSimilarity>(allocs, storage, packed);
+                 }), py::arg("allocs"), py::arg("dtype") = "float64",
+                 py::arg("packed") = false)
+            .def_property_readonly("n", &PosteriorSimilarity::get_n)
+            .def_property_readonly("n_iter", &PosteriorSimilarity::get_n_iter)
+            .def_property_readonly("packed", &PosteriorSimilarity::is_packed)
+            .def_property_readonly("nbytes", &PosteriorSimilarity::nbytes)
+            .def_property_readonly("dtype", [](const PosteriorSimilarity &self) {
+                return storage_name(self.get_storage());
+            })
+            .def("__call__", &PosteriorSimilarity::operator())
+            .def("pair_sum", &PosteriorSimilarity::pair_sum)
+            .def("to_dense", &PosteriorSimilarity::to_dense,
+                 py::call_guard<py::gil_scoped_release>())
+            .def("binder_losses", &PosteriorSimilarity::binder_losses,
+                 py::arg("allocs"), py::arg("a") = 1.0, py::arg("b") = 1.0,
+                 py::call_guard<py::gil_scoped_release>())
+            // Zero-copy read-only view on the stored values, of shape (n, n)
+            // or (n (n - 1) / 2, ) if packed, which keeps the matrix alive
+            .def("values", [](py::object self) {
+                auto &psm = self.cast<const PosteriorSimilarity &>();
+                return psm.visit([&](const auto *p) {
+                    using T = std::decay_t<decltype(*p)>;
+                    std::vector <py::ssize_t> shape{psm.get_n(), psm.get_n()};
+                    if (psm.is_packed()) {
+                        shape = {py::ssize_t(psm.get_n()) * (psm.get_n() - 1) / 2};
+                    }
+                    py::array_t<T> out(shape, p, self);
+                    py::detail::array_proxy(out.ptr())->flags &=
+                            ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+                    return py::array(std::move(out));
+                });
+            });
+}
@@ -0,0 +1,100 @@
+#ifndef PYBMIX_PSM_
+#define PYBMIX_PSM_
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+
+#include <cstdint>
+#include <string>
+#include <variant>
+#include <vector>
+#include <Eigen/Dense>
+
+//! Posterior similarity matrix, i.e. the estimate of P(c_i = c_j | data)
+//! given by the fraction of iterations in which items i and j are clustered
+//! together.
+//!
+//! Co-clustering counts are computed in square tiles of items processed in
+//! parallel, each tile scanning the allocation matrix once with a branch-free
+//! inner loop over contiguous items. The matrix is stored either in full
+//! (n x n, row-major) or packed, i.e. only its strict upper triangle row by
+//! row (the diagonal is always one), with float64, float32 or uint16 values.
+//! uint16 values are fixed-point with resolution 1 / 65535, so a packed uint16
+//! matrix takes n (n - 1) bytes, about an eighth of the
+//! 8 n^2 bytes of the full float64 one.
+class PosteriorSimilarity {
+public:
+    enum class Storage { Float64, Float32, UInt16 };
+
+    using AllocationMatrix = Eigen::Matrix<int32_t, Eigen::Dynamic,
+            Eigen::Dynamic, Eigen::RowMajor>;
+
+    //! Side of the tiles of items used to compute the counts
+    static constexpr int TILE_SIZE = 256;
+
+    //! `allocs` is a (n_iter, n) matrix with one partition per row
+    PosteriorSimilarity(const Eigen::Ref<const AllocationMatrix> &allocs,
+                        Storage storage = Storage::Float64, bool packed = false);
+
+    int get_n() const { return n; }
+
+    int get_n_iter() const { return n_iter; }
+
+    Storage get_storage() const { return storage; }
+
+    bool is_packed() const { return packed; }
+
+    //! Bytes used by the stored values
+    size_t nbytes() const;
+
+    double operator()(int i, int j) const;
+
+    Eigen::MatrixXd to_dense() const;
+
+    //! Sum of P(c_i = c_j) over all the pairs i < j
+    double pair_sum() const { return sum_pairs; }
+
+    //! Expected Binder loss of each partition (row) in `allocs`, where `a` is
+    //! the cost of clustering together two items that are apart in the true
+    //! partition and `b` the cost of separating two items that are together,
+    //! i.e. sum_{i < j} a 1[c_i = c_j] (1 - p_ij) + b 1[c_i != c_j] p_ij.
+    //! The partitions are scored in parallel.
+    Eigen::VectorXd binder_losses(const Eigen::Ref<const AllocationMatrix> &allocs,
+                                  double a = 1.0, double b = 1.0) const;
+
+    //! Applies `f` to a pointer to the stored values
+    template<typename F>
+    decltype(auto) visit(F &&f) const {
+        return std::visit([&f](const auto &v) { return f(v.data()); }, values);
+    }
+
+    //! Position of the pair (i, j), i < j, in the stored values
+    int64_t offset(int i, int j) const {
+        if (packed) return int64_t(i) * (2 * int64_t(n) - i - 1) / 2 + (j - i - 1);
+        return int64_t(i) * n + j;
+    }
+
+    static double decode(double value) { return value; }
+
+    static double decode(float value) { return value; }
+
+    static double decode(uint16_t value) { return value / 65535.0; }
+
+    static Storage storage_from_string(const std::string &name);
+
+protected:
+    template<typename T>
+    void fill(const Eigen::Ref<const AllocationMatrix> &allocs, T *out);
+
+    int n;
+    int n_iter;
+    Storage storage;
+    bool packed;
+    double sum_pairs = 0.0;
+    std::variant <std::vector<double>, std::vector<float>,
+    std::vector<uint16_t>> values;
+};
+
+void add_psm(pybind11::module &m);
+
+#endif
@@ -1,51 +1,95 @@
 #include "auxiliary_functions.h"
-#include <sstream>
+#include <string>
 #include <vector>
 
-//! Synchronize rng c++ state to Python rng state
-void synchronize_cpp_to_py_state(const std::mt19937 &cpp_gen,
-                                 py::object &py_gen) {
-    std::stringstream state{};
-    state << cpp_gen;
+namespace {
+//! The following mirror numpy/random/src/mt19937/mt19937.h, so that the
+//! Generator produces the same values numpy's own MT19937 would
+uint32_t mt19937_next32(void *st) {
+    return static_cast<uint32_t>((*static_cast<std::mt19937 *>(st))());
+}
 
-    std::string aux_string{};
-    py::list state_list{};
+uint64_t mt19937_next64(void *st) {
+    uint64_t hi = mt19937_next32(st);
+    uint64_t lo = mt19937_next32(st);
+    return hi << 32 | lo;
+}
 
-    for (unsigned int n = 0; n < 624; ++n) {
-        state >> aux_string;
-        state_list.append(std::stoul(aux_string));
-    }
-    state >> aux_string;
-    unsigned int pos = std::stoul(aux_string);
-
-    py::module_ numpy = py::module_::import("numpy");
-    py::object array = numpy.attr("array")(state_list, "uint32");
-    py::dict state_dict("key"_a = array, "pos"_a = pos);
-    py::dict d("bit_generator"_a = "MT19937", "state"_a = state_dict);
-    py_gen.attr("__setstate__")(d);
-}
-
-//! Synchronize rng Python state to c++ rng state
-void synchronize_py_to_cpp_state(std::mt19937 &cpp_gen,
-                                 const py::object &py_gen) {
-    py::object py_state = py_gen.attr("__getstate__")();
-    py::object state_ = py_state["state"]["key"].attr("tolist")();
-    auto pos_ = py_state["state"]["pos"].cast<unsigned int>();
-
-    std::stringstream ss_state_;
-    for (auto elem: state_) {
-        ss_state_ << elem.cast<unsigned int>() << " ";
-    }
-    ss_state_ << pos_;
-    ss_state_ >> cpp_gen;
+double mt19937_next_double(void *st) {
+    int32_t a = mt19937_next32(st) >> 5;
+    int32_t b = mt19937_next32(st) >> 6;
+    return (a * 67108864.0 + b) / 9007199254740992.0;
+}
+
+uint64_t mt19937_next_raw(void *st) {
+    return mt19937_next32(st);
 }
 
-//! Convert py::list to std::vector<double>
-std::vector<double> list_to_vector(py::list &x) {
-    unsigned int size = x.size();
-    std::vector<double> v(size);
-    for (unsigned int i = 0; i < size; ++i) {
-        v[i] = x[i].cast<double>();
+void destroy_bitgen(PyObject *capsule) {
+    delete static_cast<bitgen_t *>(PyCapsule_GetPointer(capsule, "BitGenerator"));
+}
+}  // namespace
+
+bitgen_t make_bitgen(std::mt19937 &cpp_gen) {
+    return bitgen_t{&cpp_gen, &mt19937_next64, &mt19937_next32,
+                    &mt19937_next_double, &mt19937_next_raw};
+}
+
+//! Wrap the c++ engine in a numpy Generator sharing its state
+py::object make_py_generator(std::mt19937 &cpp_gen) {
+    auto *bitgen = new bitgen_t(make_bitgen(cpp_gen));
+    py::capsule capsule(bitgen, "BitGenerator", &destroy_bitgen);
+
+    // numpy.random.Generator only needs the 'capsule' and 'lock' attributes
+    py::object threading = py::module_::import("threading");
+    py::object bit_generator = py::module_::import("types").attr("SimpleNamespace")(
+            "capsule"_a = capsule, "lock"_a = threading.attr("Lock")());
+    return py::module_::import("numpy.random").attr("Generator")(bit_generator);
+}
+
+//! Convert a sequence of numbers to std::vector<double>
+std::vector<double> array_to_vector(const py::handle &x) {
+    auto arr = py::array_t<double, py::array::c_style | py::array::forcecast>::ensure(x);
+    if (!arr) {
+        throw py::type_error("Expected a sequence of numbers, found " +
+                             std::string(py::repr(x)));
     }
-    return v;
+    return std::vector<double>(arr.data(), arr.data() + arr.size());
+}
+
+//! Wrap a matrix buffer in a read-only numpy array without copying
+py::array array_view(const double *data, py::ssize_t rows, py::ssize_t cols,
+                     bool row_major) {
+    py::ssize_t itemsize = sizeof(double);
+    std::vector<py::ssize_t> strides = row_major ?
+            std::vector<py::ssize_t>{itemsize * cols, itemsize} :
+            std::vector<py::ssize_t>{itemsize, itemsize * rows};
+    py::array out(py::dtype::of<double>(), {rows, cols}, strides, data,
+                  py::none());
+    py::detail::array_proxy(out.ptr())->flags &=
+            ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return out;
+}
+
+//! Wrap an Eigen matrix in a read-only numpy array without copying
+py::array eigen_view(const Eigen::MatrixXd &mat) {
+    return array_view(mat.data(), mat.rows(), mat.cols(), false);
+}
+
+//! Wrap a vector buffer in a read-only numpy array without copying
+py::array vector_view(const double *data, py::ssize_t size) {
+    py::array out(py::dtype::of<double>(), {size}, {}, data, py::none());
+    py::detail::array_proxy(out.ptr())->flags &=
+            ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return out;
+}
+
+py::array vector_view(const std::vector<double> &v) {
+    return vector_view(v.data(), v.size());
+}
+
+//! Wrap a vector in a writeable numpy array without copying
+py::array mutable_vector_view(std::vector<double> &v) {
+    return py::array(py::dtype::of<double>(), {py::ssize_t(v.size())}, {},
+                     v.data(), py::none());
 }
@@ -1,8 +1,11 @@
 #ifndef PYBMIX_AUXILIARY_FUNCTIONS_H
 #define PYBMIX_AUXILIARY_FUNCTIONS_H
 
+#include <cstdint>
 #include <random>
+#include <Eigen/Dense>
 #include <pybind11/embed.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 
 //! Collection of auxiliary functions which simplify passing data and
@@ -11,12 +14,48 @@
 namespace py = pybind11;
 using namespace py::literals;
 
-void synchronize_cpp_to_py_state(const std::mt19937 &cpp_gen,
-                                 py::object &py_gen);
+//! Layout-compatible copy of numpy's `bitgen_t` (numpy/random/bitgen.h), the
+//! struct that numpy.random.Generator reads from a BitGenerator's capsule
+struct bitgen_t {
+    void *state;
+    uint64_t (*next_uint64)(void *st);
+    uint32_t (*next_uint32)(void *st);
+    double (*next_double)(void *st);
+    uint64_t (*next_raw)(void *st);
+};
 
-void synchronize_py_to_cpp_state(std::mt19937 &cpp_gen,
-                                 const py::object &py_gen);
+//! Returns a bitgen_t drawing from `cpp_gen`, with the same outputs of
+//! numpy's MT19937. The engine must outlive it.
+bitgen_t make_bitgen(std::mt19937 &cpp_gen);
 
-std::vector<double> list_to_vector(py::list &x);
+//! Returns a numpy.random.Generator drawing directly from `cpp_gen`.
+//! No state is copied: every number drawn in Python advances the C++ engine,
+//! so the Python and C++ streams never need to be synchronized. Outputs are
+//! built exactly as numpy's MT19937 builds them, hence the draw sequence only
+//! depends on the seed of `cpp_gen`. The engine must outlive the generator.
+py::object make_py_generator(std::mt19937 &cpp_gen);
+
+//! Converts any sequence of numbers (numpy array, list, ...) to a vector,
+//! with a single bulk copy when `x` is already a contiguous float64 array
+std::vector<double> array_to_vector(const py::handle &x);
+
+//! Returns a read-only numpy view of the (rows, cols) matrix stored at `data`
+//! in row- or column-major order; no data is copied, so the view is valid
+//! only while the underlying buffer is alive and not reallocated
+py::array array_view(const double *data, py::ssize_t rows, py::ssize_t cols,
+                     bool row_major);
+
+//! Returns a read-only numpy view of `mat`, see array_view()
+py::array eigen_view(const Eigen::MatrixXd &mat);
+
+//! Returns a read-only 1-D numpy view of the `size` values at `data`, valid
+//! only while the underlying buffer is alive and not reallocated
+py::array vector_view(const double *data, py::ssize_t size);
+
+py::array vector_view(const std::vector<double> &v);
+
+//! Returns a writeable 1-D numpy view of `v`: Python code can update its
+//! values in place, but not resize it
+py::array mutable_vector_view(std::vector<double> &v);
 
 #endif //PYBMIX_AUXILIARY_FUNCTIONS_H
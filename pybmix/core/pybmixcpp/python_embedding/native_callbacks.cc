@@ -0,0 +1,41 @@
+#include "native_callbacks.h"
+
+#include <stdexcept>
+
+namespace {
+template<typename F>
+void read_address(const py::handle &address, F *out) {
+    *out = reinterpret_cast<F>(address.cast<uintptr_t>());
+}
+}  // namespace
+
+NativeCallbacks NativeCallbacks::from_dict(const py::dict &callbacks) {
+    NativeCallbacks out;
+    for (auto item: callbacks) {
+        std::string name = item.first.cast<std::string>();
+        if (name == "like_lpdf") {
+            read_address(item.second, &out.like_lpdf);
+        } else if (name == "marg_lpdf") {
+            read_address(item.second, &out.marg_lpdf);
+        } else if (name == "draw") {
+            read_address(item.second, &out.draw);
+        } else if (name == "compute_posterior_hypers") {
+            read_address(item.second, &out.compute_posterior_hypers);
+        } else if (name == "update_summary_statistics") {
+            read_address(item.second, &out.update_summary_statistics);
+        } else if (name == "sample_full_cond") {
+            read_address(item.second, &out.sample_full_cond);
+        } else if (name == "update_hypers") {
+            read_address(item.second, &out.update_hypers);
+        } else if (name == "sum_stats_size") {
+            out.sum_stats_size = item.second.cast<int64_t>();
+        } else {
+            throw std::invalid_argument("Unknown native callback '" + name + "'");
+        }
+    }
+    if (out.update_summary_statistics && out.sum_stats_size <= 0) {
+        throw std::invalid_argument(
+                "Native update_summary_statistics requires 'sum_stats_size'");
+    }
+    return out;
+}
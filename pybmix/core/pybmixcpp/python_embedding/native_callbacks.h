@@ -0,0 +1,89 @@
+#ifndef PYBMIX_NATIVE_CALLBACKS_H
+#define PYBMIX_NATIVE_CALLBACKS_H
+
+#include <cstdint>
+#include <string>
+#include <pybind11/pybind11.h>
+
+#include "auxiliary_functions.h"
+
+/*
+Native callbacks
+
+A Python hierarchy module can provide compiled implementations of its methods,
+e.g. numba @cfunc's or functions of a shared library loaded with ctypes, by
+defining a function `native_callbacks()` that returns a dict mapping method
+names to the addresses of the functions (`cfunc.address` in numba,
+`ctypes.cast(f, ctypes.c_void_p).value` in ctypes). PythonHierarchy then calls
+them directly, without the GIL nor any conversion. Methods missing from the
+dict fall back on their Python implementation.
+
+All arrays are contiguous float64, sizes are int64. Functions must not call
+into Python. `rng` is numpy's bitgen_t for the bayesmix random engine, draw
+uniforms with `rng->next_double(rng->state)`. The signatures are:
+
+  like_lpdf(x, dim, state, state_size) -> double
+  marg_lpdf(x, dim, hypers, n_hypers) -> double
+  draw(state, state_size, hypers, n_hypers, rng, out)
+      writes state_size values in out
+  compute_posterior_hypers(card, hypers, n_hypers, sum_stats, n_stats, out)
+      writes n_hypers values in out
+  update_summary_statistics(x, dim, add, sum_stats, n_stats, state, state_size)
+      updates sum_stats in place, add is an int32 flag
+  sample_full_cond(state, state_size, sum_stats, n_stats, rng, data, card,
+                   dim, hypers, n_hypers)
+      updates state and sum_stats in place, data is (card, dim) row-major
+  update_hypers(states, n_clusters, state_dim, hypers, n_hypers, rng)
+      updates hypers in place, states is (n_clusters, state_dim) row-major
+
+The dict must also contain "sum_stats_size", the number of summary statistics,
+when update_summary_statistics is native.
+*/
+
+extern "C" {
+typedef double (*native_like_lpdf_t)(const double *, int64_t, const double *,
+                                     int64_t);
+typedef double (*native_marg_lpdf_t)(const double *, int64_t, const double *,
+                                     int64_t);
+typedef void (*native_draw_t)(const double *, int64_t, const double *, int64_t,
+                              bitgen_t *, double *);
+typedef void (*native_posterior_hypers_t)(int64_t, const double *, int64_t,
+                                          const double *, int64_t, double *);
+typedef void (*native_update_summary_statistics_t)(const double *, int64_t,
+                                                   int32_t, double *, int64_t,
+                                                   const double *, int64_t);
+typedef void (*native_sample_full_cond_t)(double *, int64_t, double *, int64_t,
+                                          bitgen_t *, const double *, int64_t,
+                                          int64_t, const double *, int64_t);
+typedef void (*native_update_hypers_t)(const double *, int64_t, int64_t,
+                                       double *, int64_t, bitgen_t *);
+}
+
+//! Table of the native implementations provided by a hierarchy module, null
+//! pointers for the methods implemented in Python only
+struct NativeCallbacks {
+    native_like_lpdf_t like_lpdf = nullptr;
+    native_marg_lpdf_t marg_lpdf = nullptr;
+    native_draw_t draw = nullptr;
+    native_posterior_hypers_t compute_posterior_hypers = nullptr;
+    native_update_summary_statistics_t update_summary_statistics = nullptr;
+    native_sample_full_cond_t sample_full_cond = nullptr;
+    native_update_hypers_t update_hypers = nullptr;
+    int64_t sum_stats_size = 0;
+
+    //! Reads the table from the dict returned by `native_callbacks()`, throws
+    //! std::invalid_argument on unknown names
+    static NativeCallbacks from_dict(const py::dict &callbacks);
+
+    //! Whether the methods called while sampling are all native, so that the
+    //! hierarchy never needs the GIL. Additive statistics declared with
+    //! suff_stat replace update_summary_statistics.
+    bool is_complete(bool conjugate, bool additive_stats = false) const {
+        bool common = like_lpdf && draw && update_hypers &&
+                      (update_summary_statistics || additive_stats);
+        return common && (conjugate ? marg_lpdf && compute_posterior_hypers
+                                    : sample_full_cond != nullptr);
+    }
+};
+
+#endif //PYBMIX_NATIVE_CALLBACKS_H
@@ -5,9 +5,9 @@
 #include <pybind11/pybind11.h>
 
 #include <Eigen/Dense>
+#include <algorithm>
 #include <cmath>
 #include <random>
-#include <sstream>
 #include <stan/math/prim/prob.hpp>
 #include <string>
 #include <vector>
@@ -17,7 +17,9 @@
 #include "bayesmix/src/utils/rng.h"
 #include "hierarchy_prior.pb.h"
 #include "ls_state.pb.h"
+#include "profiler.hpp"
 #include <pybind11/eigen.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 
 std::shared_ptr <AbstractHierarchy> PythonHierarchy::clone() const {
@@ -42,6 +44,8 @@ std::shared_ptr <AbstractHierarchy> PythonHierarchy::deep_clone() const {
     auto curr_hypers_proto = get_hypers_proto();
     out->set_hypers_from_proto(*curr_hypers_proto.get());
     out->initialize();
+    out->suff_stats_table = suff_stats_table;
+    out->clear_summary_statistics();
     return out;
 }
 
@@ -89,46 +93,87 @@ PythonHierarchy::get_state_proto() const {
 void PythonHierarchy::set_hypers_from_proto(
         const google::protobuf::Message &hypers_) {
     auto &hyperscast = downcast_hypers(hypers_).general_state();
-    int size = hyperscast.data().size();
-    std::vector<double> aux_v{};
-    for (int i = 0; i < size; ++i) {
-        aux_v.push_back((hyperscast.data())[i]);
-    }
-    hypers->generic_hypers = aux_v;
+    hypers->generic_hypers.assign(hyperscast.data().begin(),
+                                  hyperscast.data().end());
 }
 
 void PythonHierarchy::set_module(const std::string &module_name) {
     std::cout << "Using hierarchy implementation in " << module_name << ".py" << std::endl;
 
-    hier_implementation = py::module_::import(module_name.c_str());
-
-    draw_evaluator = hier_implementation.attr("draw");
-    is_conjugate_evaluator = hier_implementation.attr("is_conjugate");
-    initialize_state_evaluator = hier_implementation.attr("initialize_state");
-    initialize_hypers_evaluator = hier_implementation.attr("initialize_hypers");
-    like_lpdf_evaluator = hier_implementation.attr("like_lpdf");
-    update_hypers_evaluator = hier_implementation.attr("update_hypers");
-    update_summary_statistics_evaluator =
-            hier_implementation.attr("update_summary_statistics");
-
-    if (is_conjugate_evaluator().cast<bool>()) {
-        posterior_hypers_evaluator =
-                hier_implementation.attr("compute_posterior_hypers");
-        marg_lpdf_evaluator = hier_implementation.attr("marg_lpdf");
+    // The last clone to go releases the Python objects, possibly from a
+    // thread not holding the GIL
+    evaluators = std::shared_ptr<PyHier::Evaluators>(
+            new PyHier::Evaluators, [](PyHier::Evaluators *ev) {
+                py::gil_scoped_acquire gil;
+                delete ev;
+            });
+    cluster_data_values.resize(0, 0);
+
+    auto &ev = *evaluators;
+    std::mt19937 &rng = bayesmix::Rng::Instance().get();
+    ev.module = py::module_::import(module_name.c_str());
+    ev.py_gen = make_py_generator(rng);
+    ev.native_rng = make_bitgen(rng);
+
+    ev.draw = ev.module.attr("draw");
+    ev.initialize_state = ev.module.attr("initialize_state");
+    ev.initialize_hypers = ev.module.attr("initialize_hypers");
+    ev.like_lpdf = ev.module.attr("like_lpdf");
+    ev.update_hypers = ev.module.attr("update_hypers");
+
+    // Additive statistics make update_summary_statistics optional
+    if (py::hasattr(ev.module, "suff_stat")) {
+        ev.suff_stat = ev.module.attr("suff_stat");
+    }
+    if (!ev.suff_stat || py::hasattr(ev.module, "update_summary_statistics")) {
+        ev.update_summary_statistics = ev.module.attr("update_summary_statistics");
+    }
+
+    conjugate = ev.module.attr("is_conjugate")().cast<bool>();
+    if (conjugate) {
+        ev.posterior_hypers = ev.module.attr("compute_posterior_hypers");
+        ev.marg_lpdf = ev.module.attr("marg_lpdf");
     } else {
-        sample_full_cond_evaluator = hier_implementation.attr("sample_full_cond");
+        ev.sample_full_cond = ev.module.attr("sample_full_cond");
+    }
+
+    // Vectorized lpdfs are optional, grids are evaluated row by row otherwise
+    if (py::hasattr(ev.module, "like_lpdf_batch")) {
+        ev.like_lpdf_batch = ev.module.attr("like_lpdf_batch");
+    }
+    if (py::hasattr(ev.module, "marg_lpdf_batch")) {
+        ev.marg_lpdf_batch = ev.module.attr("marg_lpdf_batch");
+    }
+
+    if (py::hasattr(ev.module, "native_callbacks")) {
+        ev.native = NativeCallbacks::from_dict(
+                ev.module.attr("native_callbacks")().cast<py::dict>());
+    }
+}
+
+void PythonHierarchy::set_dataset(const Eigen::MatrixXd *const dataset) {
+    dataset_ptr = dataset;
+    if (!evaluators || !evaluators->suff_stat) return;
+    // One vectorized call per dataset, the algorithm sets it once per run
+    py::gil_scoped_acquire gil;
+    ScopedTimer timer(Profiler::PySuffStat);
+    py::array_t<double, py::array::c_style | py::array::forcecast> table =
+            evaluators->suff_stat(eigen_view(*dataset));
+    if (table.ndim() != 2 || table.shape(0) != dataset->rows()) {
+        throw std::runtime_error(
+                "suff_stat must return an array of shape (n_data, n_stats)");
     }
+    suff_stats_table = std::make_shared<const PyHier::DataMatrix>(
+            Eigen::Map<const PyHier::DataMatrix>(table.data(), table.shape(0),
+                                                 table.shape(1)));
+    clear_summary_statistics();
 }
 
 void PythonHierarchy::set_state_from_proto(
         const google::protobuf::Message &state_) {
     auto &statecast = downcast_state(state_);
-    int size = statecast.general_state().size();
-    std::vector<double> aux_v{};
-    for (int i = 0; i < size; ++i) {
-        aux_v.push_back((statecast.general_state().data())[i]);
-    }
-    state.generic_state = aux_v;
+    state.generic_state.assign(statecast.general_state().data().begin(),
+                               statecast.general_state().data().end());
     set_card(statecast.cardinality());
 }
 
@@ -152,6 +197,12 @@ void PythonHierarchy::write_hypers_to_proto(
 Eigen::VectorXd PythonHierarchy::conditional_pred_lpdf_grid(
         const Eigen::MatrixXd &data,
         const Eigen::MatrixXd &covariates /*= Eigen::MatrixXd(0, 0)*/) const {
+    // Native lpdfs are cheaper row by row than a vectorized Python call
+    if (covariates.cols() == 0 && evaluators->marg_lpdf_batch &&
+        !evaluators->native.marg_lpdf) {
+        return lpdf_batch(evaluators->marg_lpdf_batch, data,
+                          posterior_hypers.generic_hypers);
+    }
     Eigen::VectorXd lpdf(data.rows());
     if (covariates.cols() == 0) {
         // Pass null value as covariate
@@ -176,6 +227,10 @@ Eigen::VectorXd PythonHierarchy::conditional_pred_lpdf_grid(
 Eigen::VectorXd PythonHierarchy::like_lpdf_grid(
         const Eigen::MatrixXd &data,
         const Eigen::MatrixXd &covariates /*= Eigen::MatrixXd(0, 0)*/) const {
+    if (covariates.cols() == 0 && evaluators->like_lpdf_batch &&
+        !evaluators->native.like_lpdf) {
+        return lpdf_batch(evaluators->like_lpdf_batch, data, state.generic_state);
+    }
     Eigen::VectorXd lpdf(data.rows());
     if (covariates.cols() == 0) {
         // Pass null value as covariate
@@ -199,6 +254,10 @@ Eigen::VectorXd PythonHierarchy::like_lpdf_grid(
 Eigen::VectorXd PythonHierarchy::prior_pred_lpdf_grid(
         const Eigen::MatrixXd &data,
         const Eigen::MatrixXd &covariates /*= Eigen::MatrixXd(0, 0)*/) const {
+    if (covariates.cols() == 0 && evaluators->marg_lpdf_batch &&
+        !evaluators->native.marg_lpdf) {
+        return lpdf_batch(evaluators->marg_lpdf_batch, data, hypers->generic_hypers);
+    }
     Eigen::VectorXd lpdf(data.rows());
     if (covariates.cols() == 0) {
         // Pass null value as covariate
@@ -229,39 +288,56 @@ void PythonHierarchy::initialize() {
     clear_summary_statistics();
 }
 
-//! PYTHON
-bool PythonHierarchy::is_conjugate() const {
-    return is_conjugate_evaluator().cast<bool>();
-}
-
-//! PYTHON
 void PythonHierarchy::clear_summary_statistics() {
-    cluster_data_values.resize(0,0);
-    sum_stats = std::vector<double>(0,sum_stats.size());
+    // Additive and native statistics are updated in place, so they need their
+    // full size
+    if (suff_stats_table) {
+        sum_stats.assign(suff_stats_table->cols(), 0.0);
+    } else {
+        sum_stats.assign(evaluators ? evaluators->native.sum_stats_size : 0, 0.0);
+    }
 }
 
 //! PYTHON
 PyHier::Hyperparams PythonHierarchy::compute_posterior_hypers() const {
     PyHier::Hyperparams post_params;
-    py::list post_params_py =
-            posterior_hypers_evaluator(card, hypers->generic_hypers, sum_stats);
-    post_params.generic_hypers = list_to_vector(post_params_py);
+    const auto &prior_hypers = hypers->generic_hypers;
+    if (auto native = evaluators->native.compute_posterior_hypers) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        post_params.generic_hypers.resize(prior_hypers.size());
+        native(card, prior_hypers.data(), prior_hypers.size(), sum_stats.data(),
+               sum_stats.size(), post_params.generic_hypers.data());
+        return post_params;
+    }
+    ScopedTimer timer(Profiler::PyPosteriorHypers);
+    py::object post_params_py = evaluators->posterior_hypers(
+            card, vector_view(prior_hypers), vector_view(sum_stats));
+    post_params.generic_hypers = array_to_vector(post_params_py);
     return post_params;
 }
 
 //! PYTHON
 PyHier::State PythonHierarchy::draw(const PyHier::Hyperparams &params) {
     PyHier::State out;
-    synchronize_cpp_to_py_state(bayesmix::Rng::Instance().get(), py_gen);
-    py::list draw_py =
-            draw_evaluator(state.generic_state, params.generic_hypers, py_gen);
-    out.generic_state = list_to_vector(draw_py);
-    synchronize_py_to_cpp_state(bayesmix::Rng::Instance().get(), py_gen);
+    if (auto native = evaluators->native.draw) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        out.generic_state.resize(state.generic_state.size());
+        native(state.generic_state.data(), state.generic_state.size(),
+               params.generic_hypers.data(), params.generic_hypers.size(),
+               &evaluators->native_rng, out.generic_state.data());
+        return out;
+    }
+    ScopedTimer timer(Profiler::PyDraw);
+    py::object draw_py = evaluators->draw(vector_view(state.generic_state),
+                                          vector_view(params.generic_hypers),
+                                          evaluators->py_gen);
+    out.generic_state = array_to_vector(draw_py);
     return out;
 }
 
 //! PYTHON
 void PythonHierarchy::sample_full_cond(const bool update_params /* = false */) {
+    ScopedTimer timer(Profiler::SampleFullCond);
     if (this->card == 0) {
         // No posterior update possible
         this->sample_prior();
@@ -270,16 +346,21 @@ void PythonHierarchy::sample_full_cond(const bool update_params /* = false */) {
             PyHier::Hyperparams params =
                     update_params ? this->compute_posterior_hypers() : posterior_hypers;
             state = this->draw(params);
+        } else if (auto native = evaluators->native.sample_full_cond) {
+            Profiler::Instance().count(Profiler::NativeCall);
+            native(state.generic_state.data(), state.generic_state.size(),
+                   sum_stats.data(), sum_stats.size(), &evaluators->native_rng,
+                   cluster_data_values.data(), card, cluster_data_values.cols(),
+                   hypers->generic_hypers.data(), hypers->generic_hypers.size());
         } else {
-            synchronize_cpp_to_py_state(bayesmix::Rng::Instance().get(), py_gen);
-            py::list result = sample_full_cond_evaluator(
-                    state.generic_state, sum_stats, py_gen, cluster_data_values,
-                    hypers->generic_hypers);
-            synchronize_py_to_cpp_state(bayesmix::Rng::Instance().get(), py_gen);
-            py::list state_list = result[0];
-            py::list sum_stats_list = result[1];
-            state.generic_state = list_to_vector(state_list);
-            sum_stats = list_to_vector(sum_stats_list);
+            // State and statistics may be updated in place by the module
+            ScopedTimer timer(Profiler::PySampleFullCond);
+            py::sequence result = evaluators->sample_full_cond(
+                    mutable_vector_view(state.generic_state),
+                    mutable_vector_view(sum_stats), evaluators->py_gen,
+                    cluster_data_view(), vector_view(hypers->generic_hypers));
+            state.generic_state = array_to_vector(result[0]);
+            sum_stats = array_to_vector(result[1]);
         }
     }
 }
@@ -287,6 +368,17 @@ void PythonHierarchy::sample_full_cond(const bool update_params /* = false */) {
 void PythonHierarchy::sample_full_cond(
         const Eigen::MatrixXd &data,
         const Eigen::MatrixXd &covariates /*= Eigen::MatrixXd(0, 0)*/) {
+    // Ids index `data` here, not the dataset of the statistics table, which
+    // is put back also if the Python module throws
+    struct TableGuard {
+        std::shared_ptr<const PyHier::DataMatrix> &table;
+        std::shared_ptr<const PyHier::DataMatrix> saved;
+
+        explicit TableGuard(std::shared_ptr<const PyHier::DataMatrix> &table)
+                : table(table), saved(std::move(table)) {}
+
+        ~TableGuard() { table = std::move(saved); }
+    } guard(suff_stats_table);
     clear_data();
     clear_summary_statistics();
     if (covariates.cols() == 0) {
@@ -321,35 +413,45 @@ void PythonHierarchy::save_posterior_hypers() {
 //! PYTHON
 void PythonHierarchy::update_hypers(
         const std::vector <bayesmix::AlgorithmState::ClusterState> &states) {
-    // std::cout << "Starting update_hypers!" << std::endl;
-    unsigned int size_states = states.size();
-    std::vector <std::vector<double>> pass_states{};
-    pass_states.reserve(size_states);
-    unsigned int size;
-    for (auto &st: states) {
-        size = st.general_state().size();
-        std::vector<double> aux_v{};
-        aux_v.reserve(size);
-        for (int i = 0; i < size; ++i) {
-            aux_v.push_back((st.general_state().data())[i]);
+    ScopedTimer timer(Profiler::UpdateHypers);
+    // Cluster states are passed as the rows of a single 2D array
+    py::ssize_t n_states = states.size();
+    py::ssize_t dim = n_states > 0 ? states[0].general_state().data_size() : 0;
+    auto fill_states = [&](double *out) {
+        for (auto &st: states) {
+            if (st.general_state().data_size() != dim) {
+                throw std::runtime_error("Cluster states have different sizes");
+            }
+            out = std::copy(st.general_state().data().begin(),
+                            st.general_state().data().end(), out);
         }
-        pass_states.push_back(aux_v);
+    };
+    auto &generic_hypers = hypers->generic_hypers;
+    if (auto native = evaluators->native.update_hypers) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        std::vector<double> pass_states(n_states * dim);
+        fill_states(pass_states.data());
+        native(pass_states.data(), n_states, dim, generic_hypers.data(),
+               generic_hypers.size(), &evaluators->native_rng);
+        return;
     }
-    synchronize_cpp_to_py_state(bayesmix::Rng::Instance().get(), py_gen);
-    py::list new_hypers =
-            update_hypers_evaluator(pass_states, hypers->generic_hypers, py_gen);
-    synchronize_py_to_cpp_state(bayesmix::Rng::Instance().get(), py_gen);
-    hypers->generic_hypers = list_to_vector(new_hypers);
+    ScopedTimer py_timer(Profiler::PyUpdateHypers);
+    py::array_t<double> pass_states({n_states, dim});
+    fill_states(pass_states.mutable_data());
+    py::object new_hypers = evaluators->update_hypers(
+            pass_states, vector_view(generic_hypers), evaluators->py_gen);
+    generic_hypers = array_to_vector(new_hypers);
 }
 
 void PythonHierarchy::add_datum(
         const int id, const Eigen::RowVectorXd &datum,
         const bool update_params /*= false*/,
         const Eigen::RowVectorXd &covariate /*= Eigen::RowVectorXd(0)*/) {
-    assert(cluster_data_idx.find(id) == cluster_data_idx.end());
+    ScopedTimer timer(Profiler::DatumMove);
+    assert(cluster_data_pos.find(id) == cluster_data_pos.end());
     set_card(card + 1);
-    (this)->update_ss(datum, covariate, true);
-    cluster_data_idx.insert(id);
+    if (!add_suff_stat_row(id, 1.0)) (this)->update_ss(datum, covariate, true);
+    push_datum(id, datum);
     if (update_params) {
         (this)->save_posterior_hypers();
     }
@@ -359,11 +461,10 @@ void PythonHierarchy::remove_datum(
         const int id, const Eigen::RowVectorXd &datum,
         const bool update_params /*= false*/,
         const Eigen::RowVectorXd &covariate /* = Eigen::RowVectorXd(0)*/) {
-    (this)->update_ss(datum, covariate, false);
+    ScopedTimer timer(Profiler::DatumMove);
+    if (!add_suff_stat_row(id, -1.0)) (this)->update_ss(datum, covariate, false);
     set_card(card - 1);
-    auto it = cluster_data_idx.find(id);
-    assert(it != cluster_data_idx.end());
-    cluster_data_idx.erase(it);
+    pop_datum(id);
     if (update_params) {
         (this)->save_posterior_hypers();
     }
@@ -377,9 +478,52 @@ void PythonHierarchy::check_prior_is_set() const {
 
 void PythonHierarchy::clear_data() {
     set_card(0);
-    cluster_data_idx = std::set<int>();
+    cluster_data_ids.clear();
+    cluster_data_pos.clear();
 };
 
+void PythonHierarchy::push_datum(const int id, const Eigen::RowVectorXd &datum) {
+    int pos = cluster_data_ids.size();
+    if (!conjugate) {
+        if (pos == cluster_data_values.rows()) {
+            cluster_data_values.conservativeResize(std::max(2 * pos, 4),
+                                                   datum.size());
+        }
+        cluster_data_values.row(pos) = datum;
+    }
+    cluster_data_pos[id] = pos;
+    cluster_data_ids.push_back(id);
+}
+
+void PythonHierarchy::pop_datum(const int id) {
+    auto it = cluster_data_pos.find(id);
+    assert(it != cluster_data_pos.end());
+    int pos = it->second;
+    int last = cluster_data_ids.size() - 1;
+    if (pos != last) {
+        int last_id = cluster_data_ids[last];
+        cluster_data_ids[pos] = last_id;
+        cluster_data_pos[last_id] = pos;
+        if (!conjugate) {
+            cluster_data_values.row(pos) = cluster_data_values.row(last);
+        }
+    }
+    cluster_data_ids.pop_back();
+    cluster_data_pos.erase(it);
+}
+
+bool PythonHierarchy::add_suff_stat_row(const int id, const double sign) {
+    if (!suff_stats_table) return false;
+    Eigen::Map<Eigen::RowVectorXd>(sum_stats.data(), sum_stats.size()) +=
+            sign * suff_stats_table->row(id);
+    return true;
+}
+
+py::array PythonHierarchy::cluster_data_view() const {
+    return array_view(cluster_data_values.data(), cluster_data_ids.size(),
+                      cluster_data_values.cols(), true);
+}
+
 void PythonHierarchy::create_empty_prior() {
     prior.reset(new bayesmix::PythonHierPrior);
 };
@@ -390,14 +534,20 @@ void PythonHierarchy::create_empty_hypers() {
 
 //! PYTHON
 void PythonHierarchy::initialize_state() {
-    py::list state_py = initialize_state_evaluator(hypers->generic_hypers);
-    state.generic_state = list_to_vector(state_py);
+    // Clones of a native hierarchy may be initialized without the GIL
+    py::gil_scoped_acquire gil;
+    ScopedTimer timer(Profiler::PyInitialize);
+    py::object state_py =
+            evaluators->initialize_state(vector_view(hypers->generic_hypers));
+    state.generic_state = array_to_vector(state_py);
 }
 
 //! PYTHON
 void PythonHierarchy::initialize_hypers() {
-    py::list hypers_py = initialize_hypers_evaluator();
-    hypers->generic_hypers = list_to_vector(hypers_py);
+    py::gil_scoped_acquire gil;
+    ScopedTimer timer(Profiler::PyInitialize);
+    py::object hypers_py = evaluators->initialize_hypers();
+    hypers->generic_hypers = array_to_vector(hypers_py);
 }
 
 void PythonHierarchy::set_card(const int card_) {
@@ -407,16 +557,30 @@ void PythonHierarchy::set_card(const int card_) {
 
 //! PYTHON
 double PythonHierarchy::like_lpdf(const Eigen::RowVectorXd &datum) const {
-    double result =
-            like_lpdf_evaluator(datum, state.generic_state).cast<double>();
+    if (auto native = evaluators->native.like_lpdf) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        return native(datum.data(), datum.size(), state.generic_state.data(),
+                      state.generic_state.size());
+    }
+    ScopedTimer timer(Profiler::PyLikeLpdf);
+    double result = evaluators->like_lpdf(vector_view(datum.data(), datum.size()),
+                                          vector_view(state.generic_state))
+            .cast<double>();
     return result;
 }
 
 //! PYTHON
 double PythonHierarchy::marg_lpdf(const PyHier::Hyperparams &params,
                                   const Eigen::RowVectorXd &datum) const {
-    double result =
-            marg_lpdf_evaluator(datum, params.generic_hypers).cast<double>();
+    if (auto native = evaluators->native.marg_lpdf) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        return native(datum.data(), datum.size(), params.generic_hypers.data(),
+                      params.generic_hypers.size());
+    }
+    ScopedTimer timer(Profiler::PyMargLpdf);
+    double result = evaluators->marg_lpdf(vector_view(datum.data(), datum.size()),
+                                          vector_view(params.generic_hypers))
+            .cast<double>();
     return result;
 }
 
@@ -431,13 +595,48 @@ double PythonHierarchy::marg_lpdf(const PyHier::Hyperparams &params,
     }
 };
 
+//! PYTHON
+Eigen::VectorXd PythonHierarchy::lpdf_batch(
+        const py::object &evaluator, const Eigen::MatrixXd &data,
+        const std::vector<double> &params) const {
+    ScopedTimer timer(Profiler::PyLpdfBatch);
+    py::array_t<double, py::array::c_style | py::array::forcecast> result =
+            evaluator(eigen_view(data), vector_view(params));
+    if (result.size() != data.rows()) {
+        throw std::runtime_error(
+                "Vectorized lpdf returned " + std::to_string(result.size()) +
+                " values for a grid of " + std::to_string(data.rows()) + " points");
+    }
+    return Eigen::Map<const Eigen::VectorXd>(result.data(), result.size());
+}
+
 //! PYTHON
 void PythonHierarchy::update_summary_statistics(const Eigen::RowVectorXd &datum,
                                                 const bool add) {
-    py::list results = update_summary_statistics_evaluator(
-            datum, add, sum_stats, state.generic_state, cluster_data_values);
-    py::list sum_stats_py = results[0];
-    py::array cluster_data_values_py = results[1];
-    sum_stats = list_to_vector(sum_stats_py);
-    cluster_data_values = cluster_data_values_py.cast<Eigen::MatrixXd>();
+    if (auto native = evaluators->native.update_summary_statistics) {
+        Profiler::Instance().count(Profiler::NativeCall);
+        native(datum.data(), datum.size(), add, sum_stats.data(), sum_stats.size(),
+               state.generic_state.data(), state.generic_state.size());
+        return;
+    }
+    if (!evaluators->update_summary_statistics) {
+        // Statistics of a single datum, outside of the precomputed table
+        py::gil_scoped_acquire gil;
+        ScopedTimer timer(Profiler::PySuffStat);
+        py::array_t<double, py::array::c_style | py::array::forcecast> stat =
+                evaluators->suff_stat(array_view(datum.data(), 1, datum.size(), true));
+        if (sum_stats.empty()) sum_stats.assign(stat.size(), 0.0);
+        if (stat.size() != static_cast<py::ssize_t>(sum_stats.size())) {
+            throw std::runtime_error("suff_stat returned statistics of a wrong size");
+        }
+        Eigen::Map<Eigen::RowVectorXd>(sum_stats.data(), sum_stats.size()) +=
+                (add ? 1.0 : -1.0) *
+                Eigen::Map<const Eigen::RowVectorXd>(stat.data(), stat.size());
+        return;
+    }
+    ScopedTimer timer(Profiler::PySummaryStatistics);
+    py::object sum_stats_py = evaluators->update_summary_statistics(
+            vector_view(datum.data(), datum.size()), add,
+            mutable_vector_view(sum_stats), vector_view(state.generic_state));
+    sum_stats = array_to_vector(sum_stats_py);
 }
@@ -13,10 +13,13 @@
 #include <random>
 #include <set>
 #include <stan/math/prim.hpp>
+#include <unordered_map>
 #include <vector>
 
 #include "algorithm_state.pb.h"
+#include "auxiliary_functions.h"
 #include "bayesmix/src/hierarchies/abstract_hierarchy.h"
+#include "native_callbacks.h"
 #include "hierarchy_id.pb.h"
 #include "hierarchy_prior.pb.h"
 #include "src/utils/rng.h"
@@ -30,7 +33,8 @@ Python Hierarchy
 Deriving from AbstractHierarchy, the PythonHierarchy is a generic class for
 implementing models in Python. The methods marked with PYTHON in source are
 to be implemented in a .py file located in docs/examples. The state and hypers
-are generic, stored in std::vector containers.
+are generic, stored in std::vector containers which are passed to Python as
+numpy views, without copies. Values returned by Python are copied back in bulk.
 */
 
 namespace PyHier {
@@ -43,6 +47,38 @@ namespace PyHier {
     struct Hyperparams {
         std::vector<double> generic_hypers;
     };
+
+//! Row-major storage for the data of a cluster, one datum per row
+    using DataMatrix =
+            Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+//! Python methods and native callbacks of the module implementing the
+//! hierarchy. They are shared by all the clones of a hierarchy, so that
+//! cloning never touches Python reference counts and needs no GIL; the
+//! Python objects are released with the GIL held.
+    struct Evaluators {
+        py::module_ module;
+        //! Draws directly from the bayesmix engine
+        py::object py_gen;
+        py::object draw;
+        py::object initialize_state;
+        py::object initialize_hypers;
+        py::object like_lpdf;
+        py::object marg_lpdf;
+        //! Optional vectorized lpdfs, null if not implemented in the module
+        py::object like_lpdf_batch;
+        py::object marg_lpdf_batch;
+        py::object posterior_hypers;
+        py::object sample_full_cond;
+        //! Null if the module only declares additive statistics in suff_stat
+        py::object update_summary_statistics;
+        //! Optional map from the data to additive sufficient statistics
+        py::object suff_stat;
+        py::object update_hypers;
+        //! Native implementations, see native_callbacks.h
+        NativeCallbacks native;
+        bitgen_t native_rng;
+    };
 }; // namespace Python
 
 class PythonHierarchy : public AbstractHierarchy {
@@ -61,7 +97,9 @@ public:
     int get_card() const override { return card; };
 
     //! Returns the indexes of data points belonging to this cluster
-    std::set<int> get_data_idx() const override { return cluster_data_idx; };
+    std::set<int> get_data_idx() const override {
+        return std::set<int>(cluster_data_ids.begin(), cluster_data_ids.end());
+    };
 
     //! Returns the struct of the current prior hyperparameters
     PyHier::Hyperparams get_hypers() const { return *hypers; };
@@ -110,10 +148,10 @@ public:
     std::shared_ptr <bayesmix::AlgorithmState::ClusterState>
     get_state_proto() const override;
 
-    //! Sets the (pointer to the) dataset matrix
-    void set_dataset(const Eigen::MatrixXd *const dataset) override {
-        dataset_ptr = dataset;
-    };
+    //! Sets the (pointer to the) dataset matrix. If the module defines
+    //! suff_stat, also computes the statistics of every datum, which are
+    //! shared by the clones of this hierarchy.
+    void set_dataset(const Eigen::MatrixXd *const dataset) override;
 
     //! Read and set hyperparameter values from a given Protobuf message
     void set_hypers_from_proto(const google::protobuf::Message &hypers_) override;
@@ -193,7 +231,14 @@ public:
     bool is_multivariate() const override { return false; };
 
     //! Returns whether the hierarchy is conjugate
-    bool is_conjugate() const;
+    bool is_conjugate() const { return conjugate; };
+
+    //! Returns whether all the methods called while sampling are native, in
+    //! which case the hierarchy can be used without holding the GIL
+    bool is_native() const {
+        return evaluators && evaluators->native.is_complete(
+                conjugate, static_cast<bool>(evaluators->suff_stat));
+    };
 
     //! Resets summary statistics for this cluster
     void clear_summary_statistics();
@@ -242,6 +287,20 @@ protected:
     //! Resets cardinality and indexes of data in this cluster
     void clear_data();
 
+    //! Appends a datum to the data stored in this cluster
+    void push_datum(const int id, const Eigen::RowVectorXd &datum);
+
+    //! Removes a datum from the data stored in this cluster by moving the last
+    //! stored datum in its place
+    void pop_datum(const int id);
+
+    //! Adds (sign = 1) or subtracts (sign = -1) the precomputed statistics of
+    //! datum `id` to sum_stats; returns false if they were not computed
+    bool add_suff_stat_row(const int id, const double sign);
+
+    //! Returns a read-only numpy view of the data currently in this cluster
+    py::array cluster_data_view() const;
+
     //! Re-initializes the prior of the hierarchy to a newly created object
     void create_empty_prior();
 
@@ -278,6 +337,16 @@ protected:
                              const Eigen::RowVectorXd &datum,
                              const Eigen::RowVectorXd &covariate) const;
 
+    //! Evaluates a vectorized lpdf implemented in Python on all grid rows at
+    //! once, the grid is passed as a numpy view without copies
+    //! @param evaluator  Either like_lpdf_batch or marg_lpdf_batch
+    //! @param data       Grid of points (by row) which are to be evaluated
+    //! @param params     State or hyperparameters passed to the evaluator
+    //! @return           The evaluation of the lpdf
+    Eigen::VectorXd lpdf_batch(const py::object &evaluator,
+                               const Eigen::MatrixXd &data,
+                               const std::vector<double> &params) const;
+
     //! Updates cluster statistics when a datum is added or removed from it
     //! @param datum      Data point which is being added or removed
     //! @param add        Whether the datum is being added or removed
@@ -324,8 +393,12 @@ protected:
     //! Pointer to a Protobuf prior object for this class
     std::shared_ptr <bayesmix::PythonHierPrior> prior;
 
-    //! Set of indexes of data points belonging to this cluster
-    std::set<int> cluster_data_idx;
+    //! Indexes of data points belonging to this cluster, the i-th one is
+    //! stored in the i-th row of cluster_data_values
+    std::vector<int> cluster_data_ids;
+
+    //! Maps the index of a data point to its position in cluster_data_ids
+    std::unordered_map<int, int> cluster_data_pos;
 
     //! Current cardinality of this cluster
     int card = 0;
@@ -336,32 +409,23 @@ protected:
     //! Pointer to the dataset matrix for the mixture model
     const Eigen::MatrixXd *dataset_ptr = nullptr;
 
-    //! Set of values of data points belonging to this cluster
-    Eigen::MatrixXd cluster_data_values;
+    //! Values of data points belonging to this cluster, only the first `card`
+    //! rows are in use. Kept for non-conjugate hierarchies only, whose
+    //! sample_full_cond() needs the raw data; it grows geometrically and is
+    //! never shrunk, so moving a datum costs O(dim)
+    PyHier::DataMatrix cluster_data_values;
+
+    //! Whether the hierarchy is conjugate, as declared by the Python module
+    bool conjugate = true;
 
     //! Vector of summary statistics
     std::vector<double> sum_stats;
 
-    //! Py objects for the rng
-    py::module_ numpy = py::module_::import("numpy");
-    py::module_ numpy_random = py::module_::import("numpy.random");
-    py::object py_engine = numpy_random.attr("MT19937")();
-    py::object py_gen = numpy_random.attr("Generator")(py_engine);
-
-    //! Py module where the hierarchy is implemented
-    py::module_ hier_implementation;
-
-    //! Py methods implemented in hier_implementation
-    py::object draw_evaluator;
-    py::object initialize_state_evaluator;
-    py::object initialize_hypers_evaluator;
-    py::object is_conjugate_evaluator;
-    py::object like_lpdf_evaluator;
-    py::object marg_lpdf_evaluator;
-    py::object posterior_hypers_evaluator;
-    py::object sample_full_cond_evaluator;
-    py::object update_summary_statistics_evaluator;
-    py::object update_hypers_evaluator;
+    //! Additive statistics of the dataset, one datum per row
+    std::shared_ptr<const PyHier::DataMatrix> suff_stats_table;
+
+    //! Methods of the py module where the hierarchy is implemented
+    std::shared_ptr <PyHier::Evaluators> evaluators;
 };
 
 #endif // BAYESMIX_HIERARCHIES_PYTHON_HIERARCHY_H_
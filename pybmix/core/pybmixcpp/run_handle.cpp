@@ -0,0 +1,118 @@
+#include "run_handle.hpp"
+
+#include <chrono>
+#include <cmath>
+
+#include "profiler.hpp"
+
+RunHandle::RunHandle(unsigned int n_iter, const StopRule &rule)
+        : n_iter(n_iter), rule(rule), start_ns(Profiler::now_ns()) {}
+
+RunHandle::~RunHandle() {
+    cancel();
+    if (!thread.joinable()) return;
+    // The sampler may need the GIL to reach the end of its iteration
+    if (PyGILState_Check()) {
+        pybind11::gil_scoped_release release;
+        thread.join();
+    } else {
+        thread.join();
+    }
+}
+
+bool RunHandle::wait(double timeout) {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    auto ended = [this]() { return is_done(); };
+    if (timeout < 0) {
+        done.wait(lock, ended);
+        return true;
+    }
+    return done.wait_for(lock, std::chrono::duration<double>(timeout), ended);
+}
+
+RunHandle::Status RunHandle::join() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(join_mutex);
+        if (thread.joinable()) thread.join();
+    }
+    if (error) std::rethrow_exception(error);
+    return status;
+}
+
+bool RunHandle::add_statistic(double value) {
+    n_values++;
+    double delta = value - mean;
+    mean += delta / n_values;
+    m2 += delta * (value - mean);
+    batches.add(value);
+    // Batches of single states say nothing of the autocorrelation
+    if (rule.statistic == StopRule::Statistic::None ||
+        n_values % rule.check_every != 0 || batches.batch_size < 2) {
+        return false;
+    }
+    double ess = batches.ess(m2 / (n_values - 1));
+    last_ess = ess;
+    // NaN, e.g. for a constant statistic, never meets the rule
+    return ess >= rule.target_ess;
+}
+
+void RunHandle::finish(Status final_status, std::exception_ptr run_error) {
+    end_ns = Profiler::now_ns();
+    {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        error = run_error;
+        status = final_status;
+    }
+    done.notify_all();
+}
+
+pybind11::dict RunHandle::progress() const {
+    namespace py = pybind11;
+    int64_t end = is_done() ? end_ns.load() : Profiler::now_ns();
+    double elapsed = (end - start_ns) * 1e-9;
+    unsigned int iter = iteration;
+
+    py::dict out;
+    out["iteration"] = iter;
+    out["n_iter"] = n_iter;
+    out["fraction"] = n_iter > 0 ? static_cast<double>(iter) / n_iter : 1.0;
+    out["elapsed"] = elapsed;
+    out["iterations_per_second"] = elapsed > 0 ? iter / elapsed : 0.0;
+    out["status"] = status_name(status);
+    if (rule.statistic != StopRule::Statistic::None) out["ess"] = last_ess.load();
+    return out;
+}
+
+const char *RunHandle::status_name(Status status) {
+    switch (status) {
+        case Status::Running: return "running";
+        case Status::Finished: return "finished";
+        case Status::Converged: return "converged";
+        case Status::Cancelled: return "cancelled";
+        case Status::Failed: return "failed";
+        default: return "unknown";
+    }
+}
+
+void add_run_handle(pybind11::module &m) {
+    namespace py = pybind11;
+
+    py::class_<RunHandle, std::shared_ptr<RunHandle>>(m, "RunHandle")
+            .def("cancel", &RunHandle::cancel)
+            .def("wait", &RunHandle::wait, py::arg("timeout") = -1,
+                 py::call_guard<py::gil_scoped_release>())
+            .def("join", [](RunHandle &self) {
+                RunHandle::Status status;
+                {
+                    py::gil_scoped_release release;
+                    status = self.join();
+                }
+                return RunHandle::status_name(status);
+            })
+            .def("is_done", &RunHandle::is_done)
+            .def_property_readonly("status", [](const RunHandle &self) {
+                return RunHandle::status_name(self.get_status());
+            })
+            .def("progress", &RunHandle::progress);
+}
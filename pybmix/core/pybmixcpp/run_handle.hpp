@@ -0,0 +1,107 @@
+#ifndef PYBMIX_RUN_HANDLE_
+#define PYBMIX_RUN_HANDLE_
+
+#include <pybind11/pybind11.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "online_diagnostics.hpp"
+
+//! Handle on a run of AlgorithmWrapper in a background thread, see
+//! AlgorithmWrapper::run_async. It reports the progress of the run, can
+//! cancel it and holds the stop rule checked by the sampler after every
+//! iteration. Destroying the handle cancels the run and waits for it.
+class RunHandle {
+public:
+    enum class Status { Running, Finished, Converged, Cancelled, Failed };
+
+    //! Stops the run once the effective sample size of a statistic of the
+    //! states after the burn-in reaches `target_ess`. The effective sample
+    //! size is estimated from batch means, updated in constant time at every
+    //! iteration, and checked every `check_every` iterations once the
+    //! batches hold more than one state.
+    struct StopRule {
+        enum class Statistic { None, NumClusters, LogLikelihood };
+
+        Statistic statistic = Statistic::None;
+        double target_ess = 0;
+        unsigned int check_every = 100;
+    };
+
+    RunHandle(unsigned int n_iter, const StopRule &rule);
+
+    ~RunHandle();
+
+    //! Asks the sampler to stop after the current iteration
+    void cancel() { cancel_requested = true; }
+
+    bool is_cancel_requested() const { return cancel_requested; }
+
+    //! Waits for the end of the run, at most `timeout` seconds if it is not
+    //! negative, and returns whether the run has ended
+    bool wait(double timeout = -1);
+
+    //! Waits for the end of the run and rethrows its exception, if any. May
+    //! be called from several threads at once.
+    Status join();
+
+    Status get_status() const { return status; }
+
+    bool is_done() const { return status != Status::Running; }
+
+    //! Dict with the number of iterations run "iteration", "n_iter",
+    //! "fraction", "elapsed" and "iterations_per_second", "status" and, with
+    //! a stop rule, the last effective sample size "ess"
+    pybind11::dict progress() const;
+
+    const StopRule &get_stop_rule() const { return rule; }
+
+    //! Called by the sampler after every iteration
+    void iteration_done() { iteration++; }
+
+    //! Called by the sampler with the statistic of every iteration after the
+    //! burn-in, returns true if the stop rule is met
+    bool add_statistic(double value);
+
+    //! Called by the sampler at the end of the run, also on errors
+    void finish(Status status, std::exception_ptr error = nullptr);
+
+    void set_thread(std::thread &&worker) { thread = std::move(worker); }
+
+    static const char *status_name(Status status);
+
+protected:
+    const unsigned int n_iter;
+    const StopRule rule;
+    const int64_t start_ns;
+
+    std::atomic<unsigned int> iteration{0};
+    std::atomic<Status> status{Status::Running};
+    std::atomic<bool> cancel_requested{false};
+    std::atomic<double> last_ess{0};
+    std::atomic<int64_t> end_ns{0};
+
+    //! Running mean, sum of squared deviations and batch means of the
+    //! statistic of the iterations after the burn-in, used by the sampler
+    //! thread only
+    unsigned int n_values = 0;
+    double mean = 0;
+    double m2 = 0;
+    OnlineDiagnostics::BatchMeans batches;
+
+    std::mutex done_mutex;
+    std::condition_variable done;
+    std::exception_ptr error;
+    //! Serializes the joins of `thread`
+    std::mutex join_mutex;
+    std::thread thread;
+};
+
+void add_run_handle(pybind11::module &m);
+
+#endif
@@ -1,10 +1,396 @@
 #include "serialized_collector.hpp"
 
+#include <google/protobuf/util/field_mask_util.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "algorithm_state.pb.h"
+#include "field_extractor.hpp"
+#include "profiler.hpp"
+
+namespace {
+void write_varint(uint64_t value, std::string *out) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(static_cast<uint8_t>(value) | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+}  // namespace
+
+void SerializedCollector::start_collecting() {
+    n_seen = 0;
+    last_collect_ns = 0;
+    if (file_sink) file_sink->start_collecting();
+    // Chains returned by earlier runs stay valid
+    if (compressed) {
+        compressed = std::make_shared<CompressedChain>(
+                compressed->get_keyframe_interval());
+        read_cursor = CompressedChain::Cursor();
+    }
+    chain_bytes = std::make_shared<std::string>();
+    chain_offsets = std::make_shared<std::vector<uint64_t>>();
+    read_pos = 0;
+    size = 0;
+    if (diagnostics) diagnostics->reset();
+    clear_diagnostics_indices();
+    MemoryCollector::start_collecting();
+}
+
+void SerializedCollector::finish_collecting() {
+    if (file_sink) file_sink->finish_collecting();
+    MemoryCollector::finish_collecting();
+}
+
+void SerializedCollector::resume_collecting(unsigned int n_seen_,
+                                            unsigned int n_stored) {
+    n_seen = n_seen_;
+    last_collect_ns = 0;
+    unshare_chain();
+    if (file_sink) {
+        file_sink->resume_collecting(n_stored);
+        size = n_stored;
+    }
+}
+
+void SerializedCollector::collect(const google::protobuf::Message &state) {
+    Profiler &profiler = Profiler::Instance();
+    if (profiler.is_enabled()) {
+        int64_t now = Profiler::now_ns();
+        if (last_collect_ns > 0) {
+            profiler.add(Profiler::Iteration, last_collect_ns, now - last_collect_ns);
+        }
+        last_collect_ns = now;
+    }
+    ScopedTimer timer(Profiler::Collect);
+    if (n_seen++ % thin != 0) return;
+
+    if (is_recording_allocations()) {
+        auto &algo_state =
+                google::protobuf::internal::down_cast<const bayesmix::AlgorithmState &>(state);
+        if (static_cast<unsigned int>(algo_state.cluster_allocs_size()) != n_alloc_data) {
+            throw std::invalid_argument(
+                    "Expected " + std::to_string(n_alloc_data) +
+                    " allocations, found " +
+                    std::to_string(algo_state.cluster_allocs_size()));
+        }
+        if (n_allocs == allocs->rows()) {
+            // A new matrix, the old one may be referenced by numpy views
+            auto grown = std::make_shared<AllocationMatrix>(
+                    std::max(2 * n_allocs, 1u), n_alloc_data);
+            grown->topRows(n_allocs) = allocs->topRows(n_allocs);
+            allocs = grown;
+        }
+        std::copy(algo_state.cluster_allocs().begin(),
+                  algo_state.cluster_allocs().end(), allocs->row(n_allocs).data());
+        n_allocs++;
+    }
+    if (diagnostics) {
+        update_diagnostics(
+                google::protobuf::internal::down_cast<const bayesmix::AlgorithmState &>(state));
+    }
+    if (state_callback) {
+        ScopedTimer callback_timer(Profiler::CollectCallback);
+        state_callback(state);
+    }
+    if (!store_states) return;
+    ScopedTimer store_timer(Profiler::StoreState);
+
+    const google::protobuf::Message *stored = &state;
+    if (field_mask.paths_size() > 0) {
+        if (!masked_state) masked_state.reset(state.New());
+        masked_state->Clear();
+        google::protobuf::util::FieldMaskUtil::MergeMessageTo(
+                state, field_mask,
+                google::protobuf::util::FieldMaskUtil::MergeOptions(),
+                masked_state.get());
+        stored = masked_state.get();
+    }
+
+    if (file_sink) {
+        file_sink->collect(*stored);
+        size++;
+    } else if (compressed) {
+        compressed->append(
+                google::protobuf::internal::down_cast<const bayesmix::AlgorithmState &>(
+                        *stored));
+        size++;
+    } else {
+        stored->SerializeToString(&buffer);
+        chain_offsets->push_back(chain_bytes->size());
+        write_varint(buffer.size(), chain_bytes.get());
+        chain_bytes->append(buffer);
+        size++;
+    }
+}
+
+void SerializedCollector::unshare_chain() {
+    if (chain_bytes.use_count() > 1) {
+        chain_bytes = std::make_shared<std::string>(*chain_bytes);
+    }
+    if (chain_offsets.use_count() > 1) {
+        chain_offsets = std::make_shared<std::vector<uint64_t>>(*chain_offsets);
+    }
+}
+
+void SerializedCollector::set_thinning(unsigned int thin) {
+    if (thin == 0) {
+        throw std::invalid_argument("The thinning interval must be positive");
+    }
+    this->thin = thin;
+}
+
+void SerializedCollector::set_field_mask(const std::vector <std::string> &paths) {
+    namespace gp = google::protobuf;
+    field_mask.Clear();
+    for (const auto &path: paths) {
+        if (!gp::util::FieldMaskUtil::GetFieldDescriptors(
+                bayesmix::AlgorithmState::descriptor(), path, nullptr)) {
+            throw std::invalid_argument(
+                    "'" + path + "' is not a field of bayesmix.AlgorithmState");
+        }
+        field_mask.add_paths(path);
+    }
+    masked_state.reset();
+}
+
+void SerializedCollector::record_allocations(unsigned int n_states,
+                                             unsigned int n_data) {
+    allocs = std::make_shared<AllocationMatrix>(n_states, n_data);
+    n_allocs = 0;
+    n_alloc_data = n_data;
+}
+
+void SerializedCollector::clear_allocations() {
+    allocs = std::make_shared<AllocationMatrix>();
+    n_allocs = 0;
+    n_alloc_data = 0;
+}
+
+void SerializedCollector::set_diagnostics(bool enable,
+                                          std::function<double()> log_likelihood_) {
+    // Kept if already enabled, so that handles to it see the next runs
+    if (!enable) {
+        diagnostics = nullptr;
+    } else if (!diagnostics) {
+        diagnostics = std::make_shared<OnlineDiagnostics>();
+        clear_diagnostics_indices();
+    }
+    log_likelihood = enable ? log_likelihood_ : nullptr;
+}
+
+void SerializedCollector::clear_diagnostics_indices() {
+    n_clusters_index = -1;
+    log_likelihood_index = -1;
+    mixing_fields.reset();
+}
+
+void SerializedCollector::update_diagnostics(const bayesmix::AlgorithmState &state) {
+    if (n_clusters_index < 0) n_clusters_index = diagnostics->get_index("n_clusters");
+    diagnostics->add(n_clusters_index, state.cluster_states_size());
+    if (log_likelihood) {
+        if (log_likelihood_index < 0) {
+            log_likelihood_index = diagnostics->get_index("log_likelihood");
+        }
+        diagnostics->add(log_likelihood_index, log_likelihood());
+    }
+    if (state.has_mixing_state()) {
+        if (!mixing_fields) {
+            mixing_fields = make_scalar_fields(*state.mixing_state().GetDescriptor(),
+                                               "mixing.");
+        }
+        add_scalar_fields(state.mixing_state(), mixing_fields.get());
+    }
+}
+
+std::unique_ptr<SerializedCollector::ScalarFields>
+SerializedCollector::make_scalar_fields(const google::protobuf::Descriptor &desc,
+                                        const std::string &path) {
+    namespace gp = google::protobuf;
+    auto out = std::make_unique<ScalarFields>();
+    out->path = path;
+    for (int i = 0; i < desc.field_count(); i++) {
+        const gp::FieldDescriptor *field = desc.field(i);
+        if (field->is_repeated()) continue;
+        switch (field->cpp_type()) {
+            case gp::FieldDescriptor::CPPTYPE_DOUBLE:
+            case gp::FieldDescriptor::CPPTYPE_FLOAT:
+                out->scalars.emplace_back(
+                        field, diagnostics->get_index(path + field->name()));
+                break;
+            case gp::FieldDescriptor::CPPTYPE_MESSAGE:
+                out->messages.emplace_back(field, nullptr);
+                break;
+            default:
+                break;
+        }
+    }
+    return out;
+}
+
+void SerializedCollector::add_scalar_fields(const google::protobuf::Message &msg,
+                                            ScalarFields *fields) {
+    namespace gp = google::protobuf;
+    const gp::Reflection *refl = msg.GetReflection();
+    for (const auto &scalar: fields->scalars) {
+        const gp::FieldDescriptor *field = scalar.first;
+        diagnostics->add(scalar.second,
+                         field->cpp_type() == gp::FieldDescriptor::CPPTYPE_DOUBLE
+                         ? refl->GetDouble(msg, field) : refl->GetFloat(msg, field));
+    }
+    for (auto &message: fields->messages) {
+        // Only the state of the mixing in use is set
+        const gp::FieldDescriptor *field = message.first;
+        if (!refl->HasField(msg, field)) continue;
+        if (!message.second) {
+            message.second = make_scalar_fields(*field->message_type(),
+                                                fields->path + field->name() + ".");
+        }
+        add_scalar_fields(refl->GetMessage(msg, field), message.second.get());
+    }
+}
+
+void SerializedCollector::check_not_busy() const {
+    if (busy) {
+        throw std::runtime_error(
+                "The chain is being collected by an asynchronous run: join its "
+                "handle first");
+    }
+}
+
+std::string SerializedCollector::get_state_string(unsigned int i) const {
+    check_not_busy();
+    if (file_sink) return file_sink->get_state_string(i);
+    if (compressed) return compressed->get_state_string(i);
+    const auto &offsets = *chain_offsets;
+    if (i >= offsets.size()) {
+        throw std::out_of_range("State " + std::to_string(i) + " out of range");
+    }
+    // Skip the varint with the size of the message
+    uint64_t start = offsets[i];
+    uint64_t end = i + 1 < offsets.size() ? offsets[i + 1] : chain_bytes->size();
+    while (static_cast<uint8_t>((*chain_bytes)[start]) & 0x80) start++;
+    start++;
+    return chain_bytes->substr(start, end - start);
+}
+
+std::vector <pybind11::bytes> SerializedCollector::get_serialized_chain() const {
+    check_not_busy();
+    if (file_sink) return file_sink->get_serialized_chain();
+    if (compressed) {
+        std::vector <pybind11::bytes> out(compressed->get_size());
+        CompressedChain::Cursor cursor;
+        bayesmix::AlgorithmState state;
+        for (unsigned int i = 0; i < out.size(); i++) {
+            compressed->get_state(i, &state, &cursor);
+            out[i] = (pybind11::bytes) state.SerializeAsString();
+        }
+        return out;
+    }
+
+    std::vector <pybind11::bytes> out(chain_offsets->size());
+    for (int i = 0; i < out.size(); i++) out[i] = get_serialized_state(i);
+
+    return out;
+}
+
+pybind11::array SerializedCollector::extract_field(const std::string &path) const {
+    check_not_busy();
+    if (file_sink) return file_sink->extract_field(path);
+    if (compressed) return compressed->extract_field(path);
+
+    FieldExtractor extractor(bayesmix::AlgorithmState::default_instance(), path);
+    return extractor.extract(
+            chain_offsets->size(), [this](unsigned int i, google::protobuf::Message *out) {
+                out->ParseFromString(get_state_string(i));
+            });
+}
+
+bool SerializedCollector::next_state(google::protobuf::Message *const out) {
+    if (file_sink) return file_sink->get_next_state(out);
+    if (compressed) {
+        unsigned int next = read_cursor.index + 1;
+        if (next == compressed->get_size()) {
+            read_cursor = CompressedChain::Cursor();
+            return false;
+        }
+        compressed->get_state(next, static_cast<bayesmix::AlgorithmState *>(out),
+                              &read_cursor);
+        return true;
+    }
+    if (read_pos == chain_offsets->size()) {
+        read_pos = 0;
+        return false;
+    }
+    out->ParseFromString(get_state_string(read_pos++));
+    return true;
+}
+
 void add_serialized_collector(pybind11::module &m) {
     namespace py = pybind11;
 
     py::class_<SerializedCollector>(m, "SerializedCollector")
             .def(py::init<>())
+            .def("get_size", &SerializedCollector::get_size)
             .def("get_serialized_state", &SerializedCollector::get_serialized_state)
-            .def("get_serialized_chain", &SerializedCollector::get_serialized_chain);
+            .def("get_serialized_chain", &SerializedCollector::get_serialized_chain)
+            .def("extract_field", &SerializedCollector::extract_field)
+            .def("get_file_sink", &SerializedCollector::get_file_sink)
+            .def("get_compressed_chain", &SerializedCollector::get_compressed_chain)
+            .def("get_diagnostics", &SerializedCollector::get_diagnostics)
+            // Zero-copy views on the records of the states kept in memory and
+            // on their offsets, which keep them alive
+            .def("get_chain_buffer", [](const SerializedCollector &self) {
+                auto bytes = self.get_chain_buffer();
+                py::capsule owner(new std::shared_ptr<const std::string>(bytes),
+                                  [](void *p) {
+                                      delete static_cast<
+                                              std::shared_ptr<const std::string> *>(p);
+                                  });
+                py::array_t<uint8_t> out(
+                        {static_cast<py::ssize_t>(bytes->size())}, {1},
+                        reinterpret_cast<const uint8_t *>(bytes->data()), owner);
+                py::detail::array_proxy(out.ptr())->flags &=
+                        ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+                return out;
+            })
+            .def("get_chain_offsets", [](const SerializedCollector &self) {
+                auto offsets = self.get_chain_offsets();
+                py::capsule owner(
+                        new std::shared_ptr<const std::vector<uint64_t>>(offsets),
+                        [](void *p) {
+                            delete static_cast<
+                                    std::shared_ptr<const std::vector<uint64_t>> *>(p);
+                        });
+                py::ssize_t itemsize = sizeof(uint64_t);
+                py::array_t<uint64_t> out(
+                        {static_cast<py::ssize_t>(offsets->size())}, {itemsize},
+                        offsets->data(), owner);
+                py::detail::array_proxy(out.ptr())->flags &=
+                        ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+                return out;
+            })
+            .def("is_storing_states", &SerializedCollector::is_storing_states)
+            .def("get_thinning", &SerializedCollector::get_thinning)
+            .def("is_recording_allocations",
+                 &SerializedCollector::is_recording_allocations)
+            // Zero-copy view on the allocation matrix, which keeps it alive
+            .def("get_allocations", [](const SerializedCollector &self) {
+                auto alloc = self.get_allocations();
+                py::capsule owner(
+                        new std::shared_ptr<const SerializedCollector::AllocationMatrix>(
+                                self.get_allocation_matrix()),
+                        [](void *p) {
+                            delete static_cast<std::shared_ptr<
+                                    const SerializedCollector::AllocationMatrix> *>(p);
+                        });
+                py::ssize_t rows = alloc.rows(), cols = alloc.cols();
+                py::ssize_t itemsize = sizeof(int32_t);
+                py::array_t<int32_t> out({rows, cols}, {itemsize * cols, itemsize},
+                                         alloc.data(), owner);
+                py::detail::array_proxy(out.ptr())->flags &=
+                        ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+                return out;
+            });
 }
@@ -1,27 +1,255 @@
 #ifndef PYBMIX_SERIALIZED_COLLECTOR_
 #define PYBMIX_SERIALIZED_COLLECTOR_
 
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <google/protobuf/field_mask.pb.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <Eigen/Dense>
 
 #include "bayesmix/src/collectors/memory_collector.h"
+#include "compressed_chain.hpp"
+#include "file_collector.hpp"
+#include "online_diagnostics.hpp"
 
+//! Collector used by AlgorithmWrapper. States are kept in memory in one
+//! contiguous buffer of length-delimited records, the layout of the files of
+//! StreamingFileCollector, with the offsets of the records, or in a
+//! CompressedChain or, if a file sink is set, streamed to disk by a
+//! StreamingFileCollector. On top of storing the states, it can record the
+//! cluster allocations of every iteration in a dense matrix while sampling
+//! and call a function on every state, in which case storing the states can
+//! be switched off altogether.
+//!
+//! It can also maintain OnlineDiagnostics of scalar summaries of the states.
+//!
+//! Only one every `thin` collected states is seen by any of the above, and a
+//! field mask can restrict the stored states to a subset of their fields.
 class SerializedCollector : public MemoryCollector {
 public:
+    using AllocationMatrix = Eigen::Matrix<int32_t, Eigen::Dynamic,
+            Eigen::Dynamic, Eigen::RowMajor>;
+
+    //! Called on every collected state, before it is stored
+    using StateCallback = std::function<void(const google::protobuf::Message &)>;
+
     ~SerializedCollector() = default;
 
     SerializedCollector() = default;
 
+    void start_collecting() override;
+
+    void finish_collecting() override;
+
+    void collect(const google::protobuf::Message &state) override;
+
+    //! Continues collecting after finish_collecting as if the run had not
+    //! stopped after `n_seen` states, `n_stored` of which were stored. States
+    //! stored in memory by another object can not be recovered: only the
+    //! states after the resume are kept then.
+    void resume_collecting(unsigned int n_seen, unsigned int n_stored);
+
+    unsigned int get_n_seen() const { return n_seen; }
+
+    //! Streams the states to `sink` instead of keeping them in memory,
+    //! a null pointer restores the in-memory storage
+    void set_file_sink(std::shared_ptr <StreamingFileCollector> sink) {
+        file_sink = sink;
+    }
+
+    //! While set, another thread is collecting the states, e.g. the worker of
+    //! AlgorithmWrapper::run_async, and the methods reading the chain, the
+    //! recorded allocations or the compressed chain throw. Buffers, matrices
+    //! and compressed chains returned before the run are not written to.
+    void set_busy(bool busy_) {
+        busy = busy_;
+        if (file_sink) file_sink->set_busy(busy_);
+    }
+
+    std::shared_ptr <StreamingFileCollector> get_file_sink() const {
+        return file_sink;
+    }
+
+    //! Keeps the states in memory in a CompressedChain with a keyframe every
+    //! `keyframe_interval` states, 0 restores the plain serialized strings.
+    //! The file sink, if any, takes precedence.
+    void set_compression(unsigned int keyframe_interval) {
+        compressed = keyframe_interval > 0
+                     ? std::make_shared<CompressedChain>(keyframe_interval)
+                     : nullptr;
+    }
+
+    std::shared_ptr <CompressedChain> get_compressed_chain() const {
+        check_not_busy();
+        return compressed;
+    }
+
+    void set_callback(StateCallback callback) { state_callback = callback; }
+
+    //! If `enable`, the next runs update OnlineDiagnostics of the number of
+    //! clusters, of the scalar parameters of the mixing state, named by their
+    //! path in it (e.g. "mixing.dp_state.totalmass") and, if given, of `log_likelihood` ("log_likelihood"),
+    //! which is called when the algorithm is in the collected state. The
+    //! diagnostics are reset by start_collecting and kept by resumes.
+    void set_diagnostics(bool enable, std::function<double()> log_likelihood = nullptr);
+
+    //! Null unless enabled by set_diagnostics
+    std::shared_ptr <OnlineDiagnostics> get_diagnostics() const {
+        return diagnostics;
+    }
+
+    //! If false, the collected states are not stored, only recorded
+    //! allocations and the callback see them
+    void set_store_states(bool store) { store_states = store; }
+
+    bool is_storing_states() const { return store_states; }
+
+    //! Keeps one every `thin` collected states, starting from the first. The
+    //! algorithm still builds every state it passes to collect: thinning saves
+    //! only their serialization, storage and the summaries above.
+    void set_thinning(unsigned int thin);
+
+    unsigned int get_thinning() const { return thin; }
+
+    //! Stores only the fields in `paths`, e.g. {"cluster_allocs",
+    //! "mixing_state.dp_state"}. An empty list stores the whole states.
+    //! Throws std::invalid_argument if a path is not a field of AlgorithmState.
+    void set_field_mask(const std::vector <std::string> &paths);
+
+    //! Records the allocations of the next `n_states` states, with `n_data`
+    //! observations each, in a preallocated (n_states, n_data) int32 matrix.
+    //! Further states grow the matrix geometrically. The matrix is never
+    //! resized in place: growing it and new runs swap in a new one, so that
+    //! the matrices returned by get_allocation_matrix stay valid.
+    void record_allocations(unsigned int n_states, unsigned int n_data);
+
+    //! Stops recording the allocations and frees the matrix
+    void clear_allocations();
+
+    bool is_recording_allocations() const { return n_alloc_data > 0; }
+
+    //! Returns the first `n_allocs` rows of the allocation matrix
+    Eigen::Map<const AllocationMatrix> get_allocations() const {
+        check_not_busy();
+        return Eigen::Map<const AllocationMatrix>(allocs->data(), n_allocs,
+                                                  allocs->cols());
+    }
+
+    //! The allocation matrix, of which only the first get_allocations().rows()
+    //! rows are filled
+    std::shared_ptr<const AllocationMatrix> get_allocation_matrix() const {
+        check_not_busy();
+        return allocs;
+    }
+
+    std::string get_state_string(unsigned int i) const;
+
     pybind11::bytes get_serialized_state(unsigned int i) const {
-        return (pybind11::bytes) chain[i];
+        return (pybind11::bytes) get_state_string(i);
     }
 
-    std::vector <pybind11::bytes> get_serialized_chain() const {
-        std::vector <pybind11::bytes> out(chain.size());
-        for (int i = 0; i < chain.size(); i++) out[i] = get_serialized_state(i);
+    std::vector <pybind11::bytes> get_serialized_chain() const;
 
-        return out;
+    //! Records of the states kept in memory, each a varint with the size of
+    //! the serialized state followed by the state. Later runs and resumes
+    //! leave the returned buffer untouched.
+    std::shared_ptr<const std::string> get_chain_buffer() const {
+        check_not_busy();
+        return chain_bytes;
     }
+
+    //! Offset of every record in get_chain_buffer()
+    std::shared_ptr<const std::vector <uint64_t>> get_chain_offsets() const {
+        check_not_busy();
+        return chain_offsets;
+    }
+
+    //! Returns the chain of one field as a numpy array, see FieldExtractor
+    pybind11::array extract_field(const std::string &path) const;
+
+protected:
+    bool next_state(google::protobuf::Message *const out) override;
+
+    std::shared_ptr <StreamingFileCollector> file_sink;
+
+    //! Throws std::runtime_error while set_busy(true)
+    void check_not_busy() const;
+
+    std::atomic<bool> busy{false};
+
+    //! Makes sure that no buffer shared by get_chain_buffer or
+    //! get_chain_offsets is written to
+    void unshare_chain();
+
+    //! States kept in memory, see get_chain_buffer
+    std::shared_ptr <std::string> chain_bytes = std::make_shared<std::string>();
+    std::shared_ptr <std::vector<uint64_t>> chain_offsets =
+            std::make_shared<std::vector<uint64_t>>();
+    //! Position of next_state() in the states kept in memory
+    unsigned int read_pos = 0;
+    //! Reused serialization buffer
+    std::string buffer;
+
+    std::shared_ptr <CompressedChain> compressed;
+    //! Position of next_state() in the compressed chain
+    CompressedChain::Cursor read_cursor;
+
+    StateCallback state_callback;
+    bool store_states = true;
+
+    //! Adds the summaries of `state` to the diagnostics
+    void update_diagnostics(const bayesmix::AlgorithmState &state);
+
+    //! Indices in the diagnostics of the singular float and double fields of
+    //! a message at `path` in the mixing state, e.g. "mixing.dp_state.", and
+    //! of those of its submessages, resolved the first time they are set
+    struct ScalarFields {
+        std::string path;
+        std::vector<std::pair<const google::protobuf::FieldDescriptor *,
+                unsigned int>> scalars;
+        std::vector<std::pair<const google::protobuf::FieldDescriptor *,
+                std::unique_ptr<ScalarFields>>> messages;
+    };
+
+    //! Adds the scalar fields of a message of type `desc` at `path` to the
+    //! diagnostics and returns their indices
+    std::unique_ptr<ScalarFields> make_scalar_fields(
+            const google::protobuf::Descriptor &desc, const std::string &path);
+
+    //! Adds the scalar fields of `msg` and of its set submessages
+    void add_scalar_fields(const google::protobuf::Message &msg, ScalarFields *fields);
+
+    //! Forgets the indices of the diagnostics, which are reset or replaced
+    void clear_diagnostics_indices();
+
+    std::shared_ptr <OnlineDiagnostics> diagnostics;
+    std::function<double()> log_likelihood;
+    //! Indices of the summaries in `diagnostics`, -1 or null until resolved
+    int n_clusters_index = -1;
+    int log_likelihood_index = -1;
+    std::unique_ptr<ScalarFields> mixing_fields;
+
+    unsigned int thin = 1;
+    //! Number of states collected since start_collecting
+    unsigned int n_seen = 0;
+    //! Time of the previous call to collect, when profiling
+    int64_t last_collect_ns = 0;
+
+    google::protobuf::FieldMask field_mask;
+    //! Reused message with the masked fields of the state being stored
+    std::unique_ptr <google::protobuf::Message> masked_state;
+
+    std::shared_ptr <AllocationMatrix> allocs = std::make_shared<AllocationMatrix>();
+    unsigned int n_allocs = 0;
+    unsigned int n_alloc_data = 0;
 };
 
 void add_serialized_collector(pybind11::module &m);
@@ -8,7 +8,8 @@ BUILD_DIR = os.path.join(HERE, "../../build/")
 sys.path.insert(0, os.path.realpath(BUILD_DIR))
 
 from pybmix.core.mixture_model import MixtureModel
-from pybmixcpp import _minbinder_cluster_estimate, ostream_redirect
+from pybmixcpp import PosteriorSimilarity, _partition_losses, \
+    _salso_cluster_estimate
 
 
 class ClusterEstimator(object):
@@ -18,33 +19,87 @@ class ClusterEstimator(object):
     Parameters
     ----------
     mixture_model: an instance of MixtureModel
-        the fitted mixture, assumes that 'run_mcmc' has called
+        the fitted mixture, assumes that 'run_mcmc' has called. Calling
+        'run_mcmc' with record_allocations=True avoids decoding the chain
     loss: string
-        the loss function to use. Currently supports only the Binder loss 
-        function with equal missclassification cost
+        the loss function to use, one of 'binder_equal' (Binder loss with
+        equal missclassification costs), 'binder' (Binder loss with costs
+        'binder_a' for clustering together items that are apart and 'binder_b'
+        for separating items that are together) and 'vi' (lower bound of the
+        Variation of Information)
     method: string
-        the method to find the point estimates. Currently supports
-        only the 'samples' method, that looks for the best partition among the
-        ones visited by the MCMC sampler.
+        the method to find the point estimates, either 'samples', that looks
+        for the best partition among the ones visited by the MCMC sampler, or
+        'salso', that greedily searches the space of partitions with
+        'n_restarts' random restarts run in parallel
+    psm_dtype: string
+        storage of the posterior similarity matrix, one of 'float64',
+        'float32' or 'uint16' (fixed point with resolution 1 / 65535)
+    psm_packed: bool
+        if True only the strict upper triangle of the posterior similarity
+        matrix is stored, halving its memory
+    binder_a, binder_b: float
+        the costs of the Binder loss when loss='binder'
+    n_restarts, max_sweeps, max_clusters, seed: int
+        parameters of the 'salso' method: number of restarts, maximum number
+        of sweeps per restart, maximum number of clusters (0 means no limit)
+        and seed of the first restart
     """
 
     def __init__(self, mixture_model: MixtureModel, loss="binder_equal",
-                 method="samples"):
+                 method="samples", psm_dtype="float64", psm_packed=False,
+                 binder_a=1.0, binder_b=1.0, n_restarts=16, max_sweeps=100,
+                 max_clusters=0, seed=0):
+        if loss not in ("binder_equal", "binder", "vi"):
+            raise ValueError(
+                "'loss' must be one of 'binder_equal', 'binder', 'vi', "
+                "found {0} instead".format(loss))
+        if method not in ("samples", "salso"):
+            raise ValueError(
+                "'method' must be one of 'samples', 'salso', found {0} "
+                "instead".format(method))
+
         self.model = mixture_model
-        self.chain = self.model.get_chain()
         self.loss = loss
         self.method = method
+        self.binder_a = binder_a
+        self.binder_b = binder_b
+        self.n_restarts = n_restarts
+        self.max_sweeps = max_sweeps
+        self.max_clusters = max_clusters
+        self.seed = seed
+        self.loss_value = None
+        self.psm_dtype = psm_dtype
+        self.psm_packed = psm_packed
+        self._psm = None
+
+    def get_psm(self):
+        """Returns the posterior similarity matrix as a PosteriorSimilarity,
+        use its 'to_dense' method to get it as a numpy array"""
+        if self._psm is None:
+            self._psm = PosteriorSimilarity(
+                self.model.get_allocations(), self.psm_dtype, self.psm_packed)
+        return self._psm
 
     def get_point_estimate(self):
-        if self.method == "samples" and self.loss == "binder_equal":
-            with ostream_redirect(stdout=True, stderr=True):
-                return _minbinder_cluster_estimate(
-                    self.chain.extract("cluster_allocs"))
+        loss = "vi" if self.loss == "vi" else "binder"
+        a, b = (self.binder_a, self.binder_b) if self.loss == "binder" \
+            else (1.0, 1.0)
+
+        if self.method == "salso":
+            partition, self.loss_value, _ = _salso_cluster_estimate(
+                self.get_psm(), loss, a, b, self.n_restarts, self.max_sweeps,
+                self.max_clusters, self.seed)
+            return partition
 
+        allocs = self.model.get_allocations()
+        if loss == "binder":
+            losses = self.get_psm().binder_losses(allocs, a, b)
         else:
-            raise ValueError(
-                "cluster point estimate only supports method='samples' and "
-                "loss='binder_equal' for the moment")
+            losses = _partition_losses(self.get_psm(), allocs, loss)
+        best = np.argmin(losses)
+        self.loss_value = losses[best]
+        return np.array(allocs[best])
 
     @staticmethod
     def group_by_cluster(partition):
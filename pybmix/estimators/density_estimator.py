@@ -40,10 +40,51 @@ class DensityEstimator(object):
         grid: np.array of shape (num_points, num_dimensions)
             a grid of points where to evaluate the mixture density
         mean: bool
-            if True, returns only the mean of the densities
+            if True, returns only the mean of the densities, computed without
+            storing the density of every iteration
         """
-        dens = self.model._algo.eval_density((grid))
         if mean:
-            dens = np.mean(dens, axis=0)
+            return self.density_summary(grid, probs=())["mean"]
 
-        return dens
+        return self.model._algo.eval_density((grid))
+
+    def density_summary(self, grid, probs=(0.025, 0.5, 0.975),
+                        block_size=256):
+        """Pointwise posterior summaries of the mixture density over a grid.
+        The densities are reduced while the chain is replayed (the mean in
+        log-space, the quantiles with the streaming P-square estimator), so
+        memory does not grow with the number of iterations.
+
+        Parameters
+        ----------
+        grid: np.array of shape (num_points, num_dimensions)
+            a grid of points where to evaluate the mixture density
+        probs: sequence of float
+            probabilities of the pointwise quantiles, e.g. (0.025, 0.975)
+            for 95% credible bands
+        block_size: int
+            number of grid points evaluated together, which bounds the memory
+            used by every evaluation
+
+        Returns
+        -------
+        A dictionary with the pointwise 'mean' and 'log_mean' densities, of
+        shape (len(grid), ), and the 'quantiles' of shape (len(probs),
+        len(grid)), with rows in the order of 'probs'
+        """
+        reduction = self.model._algo.eval_density_summary(
+            grid, list(probs), block_size)
+        return self._summary_dict(reduction)
+
+    def online_density_summary(self):
+        """Returns the summaries of the density on the 'density_grid' passed
+        to MixtureModel.run_mcmc, computed while sampling. Same output of
+        'density_summary'."""
+        return self._summary_dict(self.model._algo.get_online_density())
+
+    @staticmethod
+    def _summary_dict(reduction):
+        log_mean = reduction.log_mean()
+        return {"log_mean": log_mean, "mean": np.exp(log_mean),
+                "quantiles": np.exp(reduction.log_quantiles()),
+                "probs": np.array(reduction.get_probs())}
@@ -1,5 +1,54 @@
+import os
+import sys
+
 import numpy as np
 
+HERE = os.path.dirname(os.path.realpath(__file__))
+BUILD_DIR = os.path.join(HERE, "../../build/")
+
+# Default 'k_max': all the columns of the row
+_ALL_COLUMNS = 2 ** 32 - 1
+
+
+def _native():
+    """Returns the pybmixcpp extension, imported on first use so that the
+    pure Python memoizers below work without it"""
+    build_dir = os.path.realpath(BUILD_DIR)
+    if build_dir not in sys.path:
+        sys.path.insert(0, build_dir)
+    import pybmixcpp
+    return pybmixcpp
+
+
+def log_stirling(n, k_max=None):
+    """Returns log |s(n, k)| for k = 0, ..., min(n, k_max), the logarithm of
+    the unsigned Stirling numbers of the first kind, as a numpy array.
+
+    The recurrence is run natively in log space, so there is no overflow,
+    in O(n * min(n, k_max)) operations; rows are cached across calls and
+    extended from the closest cached one.
+    """
+    return _native()._log_stirling_first(
+        n, _ALL_COLUMNS if k_max is None else k_max)
+
+
+def log_generalized_factorial(n, sigma, k_max=None):
+    """Returns log C(n, k; sigma) for k = 0, ..., min(n, k_max), the
+    logarithm of the generalized factorial coefficients with parameter sigma
+    in [0, 1), see generalized_factorial_memoizer. Computed as log_stirling.
+    """
+    return _native()._log_generalized_factorial(
+        n, sigma, _ALL_COLUMNS if k_max is None else k_max)
+
+
+def log_scaled_generalized_factorial(n, sigma, k_max=None):
+    """Returns log(C(n, k; sigma) / sigma^k) for k = 0, ..., min(n, k_max),
+    which is well defined also for sigma = 0, where it equals log_stirling.
+    Computed as log_stirling.
+    """
+    return _native()._log_scaled_generalized_factorial(
+        n, sigma, _ALL_COLUMNS if k_max is None else k_max)
+
 
 class TriangularMemoizer(object):
     """Specific class for triangular recurrence sequences of the kind
@@ -0,0 +1,31 @@
+import os
+import sys
+
+HERE = os.path.dirname(os.path.realpath(__file__))
+sys.path.insert(0, os.path.realpath(os.path.join(HERE, "..")))
+
+import numpy as np
+import pytest
+
+from pybmix.core.hierarchy import UnivariateNormal
+from pybmix.core.mixing import DirichletProcessMixing
+from pybmix.core.mixture_model import MixtureModel
+
+
+@pytest.fixture
+def data():
+    """Two well separated univariate normal components"""
+    rng = np.random.default_rng(2021)
+    return np.concatenate([rng.normal(-3, 1, 50), rng.normal(3, 1, 50)])
+
+
+@pytest.fixture
+def make_model(data):
+    """Returns a function building a DP mixture of univariate normals with
+    the default prior for 'data'"""
+    def make():
+        hierarchy = UnivariateNormal()
+        hierarchy.make_default_fixed_params(data, 2)
+        return MixtureModel(DirichletProcessMixing(total_mass=1), hierarchy)
+
+    return make
@@ -0,0 +1,92 @@
+import time
+
+import numpy as np
+import pytest
+
+NITER, NBURN = 60, 10
+LONG_RUN = 10 ** 6
+
+
+def wait_for_iterations(handle, n):
+    while handle.progress()["iteration"] < n and not handle.is_done():
+        time.sleep(0.01)
+
+
+def test_async_run_matches_run(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=4)
+    async_model = make_model()
+    handle = async_model.run_mcmc_async(data, niter=NITER, nburn=NBURN,
+                                        rng_seed=4)
+
+    assert handle.join() == "finished"
+    assert handle.progress()["iteration"] == NITER
+    np.testing.assert_array_equal(async_model.get_allocations(),
+                                  model.get_allocations())
+
+
+def test_cancel_stops_the_run(data, make_model):
+    model = make_model()
+    handle = model.run_mcmc_async(data, niter=LONG_RUN, nburn=NBURN,
+                                  rng_seed=4)
+    wait_for_iterations(handle, NBURN + 20)
+    handle.cancel()
+
+    assert handle.join() == "cancelled"
+    n_run = handle.progress()["iteration"]
+    assert NBURN + 20 <= n_run < LONG_RUN
+    assert len(model.get_chain()) == n_run - NBURN
+
+    # A cancelled run can be resumed
+    model.resume(5)
+    assert len(model.get_chain()) == n_run - NBURN + 5
+
+
+def test_stop_rule_ends_the_run(data, make_model):
+    model = make_model()
+    handle = model.run_mcmc_async(data, niter=LONG_RUN, nburn=NBURN,
+                                  rng_seed=4, ess_target=50,
+                                  ess_on="log_likelihood", check_every=100)
+
+    assert handle.join() == "converged"
+    progress = handle.progress()
+    assert progress["ess"] >= 50
+    assert progress["iteration"] < LONG_RUN
+    assert (progress["iteration"] - NBURN) % 100 == 0
+    assert len(model.get_chain()) == progress["iteration"] - NBURN
+
+
+def test_wrapper_and_collectors_are_blocked_during_the_run(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=4)
+    algo = model._algo
+    collector = algo.get_collector()
+
+    handle = algo.run_async(data, LONG_RUN, NBURN, 4, 1, [], "", 0, 100)
+    try:
+        with pytest.raises(RuntimeError):
+            algo.run_async(data, NITER, NBURN, 4, 1, [], "", 0, 100)
+        with pytest.raises(RuntimeError):
+            algo.get_collector()
+        with pytest.raises(RuntimeError):
+            collector.extract_field("cluster_allocs")
+        with pytest.raises(RuntimeError):
+            collector.get_chain_buffer()
+        assert algo.get_diagnostics() is None
+    finally:
+        handle.cancel()
+        handle.join()
+
+    assert len(collector.extract_field("cluster_allocs")) == \
+        handle.progress()["iteration"] - NBURN
+
+
+def test_concurrent_joins(data, make_model):
+    from concurrent.futures import ThreadPoolExecutor
+
+    model = make_model()
+    handle = model.run_mcmc_async(data, niter=NITER * 10, nburn=NBURN,
+                                  rng_seed=4)
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        statuses = list(pool.map(lambda _: handle.join(), range(4)))
+    assert statuses == ["finished"] * 4
@@ -0,0 +1,56 @@
+import numpy as np
+
+from pybmix.core.chain import MCMCchain
+from pybmix.proto.algorithm_state_pb2 import AlgorithmState
+
+
+def make_states(n):
+    states = []
+    for i in range(n):
+        state = AlgorithmState()
+        state.iteration_num = i
+        state.cluster_allocs.extend([i % 2, 0, 1])
+        states.append(state)
+    return states
+
+
+def test_list_of_bytes_is_decoded_upfront():
+    states = make_states(5)
+    chain = MCMCchain([s.SerializeToString() for s in states], AlgorithmState)
+
+    assert len(chain) == 5
+    assert isinstance(chain.chain, np.ndarray)
+    assert list(chain.chain) == states
+    np.testing.assert_array_equal(chain.extract("iteration_num"), np.arange(5))
+
+
+def test_lazy_chain_matches_decoded_chain():
+    serialized = [s.SerializeToString() for s in make_states(5)]
+    eager = MCMCchain(serialized, AlgorithmState)
+    lazy = MCMCchain(serialized, AlgorithmState, False)
+
+    assert list(lazy.chain) == list(eager.chain)
+    np.testing.assert_array_equal(lazy.extract("cluster_allocs"),
+                                  eager.extract("cluster_allocs"))
+
+
+def test_extract_returns_a_writeable_copy():
+    chain = MCMCchain([s.SerializeToString() for s in make_states(4)],
+                      AlgorithmState)
+
+    allocs = chain.extract("cluster_allocs")
+    assert allocs.flags.writeable
+    allocs[:] = -1
+    np.testing.assert_array_equal(chain.extract("cluster_allocs")[:, 0],
+                                  [0, 1, 0, 1])
+
+
+def test_model_chain_is_compatible(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=30, nburn=10, rng_seed=2)
+    chain = model.get_chain()
+
+    decoded = MCMCchain(list(chain.serialized_chain), AlgorithmState)
+    assert list(chain.chain) == list(decoded.chain)
+    np.testing.assert_array_equal(chain.extract("cluster_allocs"),
+                                  decoded.extract("cluster_allocs"))
@@ -0,0 +1,57 @@
+import numpy as np
+import pytest
+
+NITER, NBURN, NMORE = 40, 10, 30
+
+
+@pytest.fixture
+def reference(data, make_model):
+    """Allocations of a single uninterrupted run of NITER + NMORE iterations"""
+    model = make_model()
+    model.run_mcmc(data, niter=NITER + NMORE, nburn=NBURN, rng_seed=5)
+    return model.get_allocations()
+
+
+def test_resume_continues_the_run(data, make_model, reference):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=5)
+    model.resume(NMORE)
+
+    np.testing.assert_array_equal(model.get_allocations(), reference)
+
+
+def test_resume_from_checkpoint_matches_uninterrupted_run(
+        data, make_model, reference, tmp_path):
+    first = make_model()
+    first.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=5)
+    path = str(tmp_path / "run.ckpt")
+    first.checkpoint(path)
+
+    # Draw from the random engine in between, the checkpoint restores it
+    make_model().run_mcmc(data, niter=20, nburn=5, rng_seed=11)
+
+    second = make_model()
+    second.resume(NMORE, y=data, checkpoint=path)
+
+    # The chain kept in memory by the first model is not in the checkpoint
+    np.testing.assert_array_equal(second.get_allocations(),
+                                  reference[NITER - NBURN:])
+
+
+def test_resume_from_checkpoint_needs_data(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=5)
+    with pytest.raises(ValueError):
+        make_model().resume(NMORE, checkpoint=model.checkpoint())
+
+
+def test_corrupt_checkpoint_is_rejected(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=5)
+    data_bytes = model.checkpoint()
+
+    with pytest.raises(ValueError):
+        make_model().resume(NMORE, y=data, checkpoint=b"junk" + data_bytes)
+    with pytest.raises(ValueError):
+        make_model().resume(NMORE, y=data,
+                            checkpoint=data_bytes[:len(data_bytes) // 2])
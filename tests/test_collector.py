@@ -0,0 +1,46 @@
+import numpy as np
+import pytest
+
+NITER, NBURN = 50, 10
+
+
+def test_thinning_keeps_every_thin_state(data, make_model):
+    full = make_model()
+    full.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=3)
+    thinned = make_model()
+    thinned.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=3, thin=4,
+                     record_allocations=True)
+
+    assert len(thinned.get_chain()) == 10
+    expected = full.get_allocations()[::4]
+    np.testing.assert_array_equal(thinned.get_allocations(), expected)
+    np.testing.assert_array_equal(
+        thinned.get_chain().extract("cluster_allocs"), expected)
+
+
+def test_field_mask_stores_only_the_fields(data, make_model):
+    full = make_model()
+    full.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=3)
+    masked = make_model()
+    masked.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=3,
+                    fields=["cluster_allocs"])
+
+    chain = masked.get_chain()
+    assert len(chain) == NITER - NBURN
+    assert len(chain.get_state(0).cluster_states) == 0
+    np.testing.assert_array_equal(chain.extract("cluster_allocs"),
+                                  full.get_chain().extract("cluster_allocs"))
+
+
+def test_unknown_field_is_rejected(data, make_model):
+    with pytest.raises(ValueError):
+        make_model().run_mcmc(data, niter=NITER, nburn=NBURN,
+                              fields=["not_a_field"])
+
+
+@pytest.mark.parametrize("niter, nburn, thin",
+                         [(50, 10, 0), (10, 20, 1), (50, -1, 1)])
+def test_invalid_run_arguments_are_rejected(data, make_model, niter, nburn,
+                                            thin):
+    with pytest.raises((ValueError, TypeError)):
+        make_model().run_mcmc(data, niter=niter, nburn=nburn, thin=thin)
@@ -0,0 +1,63 @@
+import numpy as np
+import pytest
+
+from pybmix.core.mixture_model import load_compressed_chain
+
+NITER, NBURN = 60, 10
+
+
+@pytest.fixture
+def runs(data, make_model):
+    """Models of the same run with the chain kept as is and compressed, with
+    keyframes every 8 states so that deltas are decoded"""
+    plain = make_model()
+    plain.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=7)
+    compressed = make_model()
+    compressed.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=7,
+                        compress_chain=8)
+    return plain, compressed
+
+
+def test_compressed_chain_matches_the_chain(runs):
+    plain, compressed = runs
+    np.testing.assert_array_equal(compressed.get_allocations(),
+                                  plain.get_allocations())
+    chain, expected = compressed.get_chain(), plain.get_chain()
+    assert len(chain) == len(expected)
+    for i in (0, 7, 8, 9, len(chain) - 1, 3):
+        assert chain.get_state(i) == expected.get_state(i)
+
+
+def test_save_and_load_round_trip(runs, tmp_path):
+    plain, compressed = runs
+    path = str(tmp_path / "chain.pbcc")
+    compressed.save_compressed_chain(path)
+
+    chain = load_compressed_chain(path)
+    np.testing.assert_array_equal(chain.extract("cluster_allocs"),
+                                  plain.get_allocations())
+    assert chain.get_state(len(chain) - 1) == \
+        plain.get_chain().get_state(len(chain) - 1)
+
+
+def test_corrupt_file_is_rejected(runs, tmp_path):
+    _, compressed = runs
+    path = tmp_path / "chain.pbcc"
+    compressed.save_compressed_chain(str(path))
+    data = path.read_bytes()
+
+    bad = tmp_path / "bad.pbcc"
+    corruptions = [
+        b"NOTACHAIN" + data[9:],
+        data[:len(data) // 2],
+        # Keyframe interval 0
+        data[:16] + bytes(8) + data[24:],
+        # Number of states larger than the file
+        data[:24] + (2 ** 40).to_bytes(8, "little") + data[32:],
+        # First allocation offset past the encoded allocations
+        data[:32] + (2 ** 40).to_bytes(8, "little") + data[40:],
+    ]
+    for corrupt in corruptions:
+        bad.write_bytes(corrupt)
+        with pytest.raises(ValueError):
+            load_compressed_chain(str(bad))
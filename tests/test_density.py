@@ -0,0 +1,31 @@
+import numpy as np
+
+from pybmix.estimators.density_estimator import DensityEstimator
+
+GRID = np.linspace(-6, 6, 40)
+PROBS = (0.1, 0.5, 0.9)
+
+
+def test_online_density_matches_offline_summary(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=60, nburn=10, rng_seed=1, density_grid=GRID,
+                   density_probs=PROBS)
+    estimator = DensityEstimator(model)
+
+    online = estimator.online_density_summary()
+    offline = estimator.density_summary(GRID, probs=PROBS)
+    np.testing.assert_allclose(online["log_mean"], offline["log_mean"],
+                               rtol=1e-10)
+    np.testing.assert_allclose(online["quantiles"], offline["quantiles"],
+                               rtol=1e-10)
+
+
+def test_density_summary_mean_matches_eval_density(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=40, nburn=10, rng_seed=1)
+    estimator = DensityEstimator(model)
+
+    densities = estimator.estimate_density(GRID)
+    summary = estimator.density_summary(GRID, probs=(), block_size=7)
+    np.testing.assert_allclose(summary["mean"], densities.mean(axis=0),
+                               rtol=1e-8)
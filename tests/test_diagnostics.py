@@ -0,0 +1,35 @@
+import numpy as np
+
+NITER, NBURN = 60, 10
+
+
+def test_diagnostics_follow_the_chain(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=6,
+                   diagnostics=True)
+    diag = model.get_diagnostics()
+    chain = model.get_chain()
+
+    names = diag.get_names()
+    assert names[:2] == ["n_clusters", "log_likelihood"]
+    assert "mixing.dp_state.totalmass" in names
+    for name in names:
+        assert diag.get_size(name) == len(chain)
+
+    n_clusters = [len(chain.get_state(i).cluster_states)
+                  for i in range(len(chain))]
+    np.testing.assert_array_equal(diag.get_trace("n_clusters"), n_clusters)
+    np.testing.assert_array_equal(diag.get_trace("mixing.dp_state.totalmass"),
+                                  np.ones(len(chain)))
+    assert np.all(np.isfinite(diag.get_trace("log_likelihood")))
+
+
+def test_resume_extends_the_diagnostics(data, make_model):
+    model = make_model()
+    model.run_mcmc(data, niter=NITER, nburn=NBURN, rng_seed=6,
+                   diagnostics=True)
+    model.resume(20)
+    diag = model.get_diagnostics()
+
+    for name in diag.get_names():
+        assert diag.get_size(name) == NITER - NBURN + 20
@@ -0,0 +1,85 @@
+import numpy as np
+import pytest
+from scipy.special import gamma, loggamma
+
+from pybmix.core.mixing import DirichletProcessMixing, PitmanYorMixing
+from pybmix.utils.combinatorials import generalized_factorial_memoizer, \
+    log_generalized_factorial, log_stirling, stirling
+
+NSAMPLES = 20
+GRID = np.arange(-1, NSAMPLES + 3)
+
+
+def baseline_dp(total_mass, grid, nsamples):
+    """The former Python implementation, on the memoized Stirling numbers"""
+    return np.array([gamma(total_mass) / gamma(total_mass + nsamples) *
+                     stirling(nsamples, k) * total_mass ** k
+                     if k >= 0 else 0.0 for k in grid])
+
+
+def baseline_py(strength, discount, grid, nsamples):
+    """The former Python implementation, on the memoized generalized
+    factorial coefficients"""
+    factorial = generalized_factorial_memoizer(discount)
+    vnk_den = loggamma(strength + nsamples) - loggamma(strength)
+    out = np.zeros(len(grid))
+    for i, k in enumerate(grid):
+        coef = factorial(nsamples, k) if k >= 0 else 0
+        if coef > 0:
+            vnk_num = np.sum([np.log(strength + l * discount)
+                              for l in range(k)])
+            out[i] = np.exp(vnk_num - vnk_den + np.log(coef) -
+                            k * np.log(discount))
+    return out
+
+
+def test_log_stirling_matches_memoizer():
+    expected = [stirling(NSAMPLES, k) for k in range(NSAMPLES + 1)]
+    with np.errstate(divide="ignore"):
+        np.testing.assert_allclose(log_stirling(NSAMPLES), np.log(expected),
+                                   rtol=1e-10)
+    assert len(log_stirling(NSAMPLES, 5)) == 6
+
+
+def test_log_generalized_factorial_matches_memoizer():
+    factorial = generalized_factorial_memoizer(0.3)
+    expected = [factorial(NSAMPLES, k) for k in range(NSAMPLES + 1)]
+    with np.errstate(divide="ignore"):
+        np.testing.assert_allclose(log_generalized_factorial(NSAMPLES, 0.3),
+                                   np.log(expected), rtol=1e-8)
+
+
+@pytest.mark.parametrize("total_mass", [0.5, 1.0, 3.0])
+def test_dp_prior_matches_baseline(total_mass):
+    mixing = DirichletProcessMixing(total_mass=total_mass)
+    out = mixing.prior_cluster_distribution(GRID, NSAMPLES)
+
+    np.testing.assert_allclose(out, baseline_dp(total_mass, GRID, NSAMPLES),
+                               rtol=1e-8)
+    np.testing.assert_allclose(out.sum(), 1.0, rtol=1e-10)
+
+
+@pytest.mark.parametrize("strength, discount", [(1.0, 0.1), (2.0, 0.5)])
+def test_py_prior_matches_baseline(strength, discount):
+    mixing = PitmanYorMixing(strength=strength, discount=discount)
+    out = mixing.prior_cluster_distribution(GRID, NSAMPLES)
+
+    np.testing.assert_allclose(
+        out, baseline_py(strength, discount, GRID, NSAMPLES), rtol=1e-8)
+    np.testing.assert_allclose(out.sum(), 1.0, rtol=1e-10)
+
+
+def test_py_prior_stays_finite_for_large_samples():
+    mixing = PitmanYorMixing(strength=1.0, discount=0.25)
+    out = mixing.prior_cluster_distribution(np.arange(2001), 2000)
+
+    assert np.all(np.isfinite(out))
+    np.testing.assert_allclose(out.sum(), 1.0, rtol=1e-8)
+
+
+@pytest.mark.parametrize("mixing", [DirichletProcessMixing(total_mass=1.0),
+                                    PitmanYorMixing(strength=1.0,
+                                                    discount=0.1)])
+def test_empty_grid(mixing):
+    out = mixing.prior_cluster_distribution([], NSAMPLES)
+    assert out.shape == (0,)